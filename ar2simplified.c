@@ -0,0 +1,1128 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define EXIT_MISMATCH 1
+#define EXIT_ERROR 2
+
+#define DEFAULT_CALIBRATION_MSEC 500UL
+#define DEFAULT_CALIBRATION_MEMORY (64UL << 10)
+
+#define DEFAULT_SERVE_BATCH 8
+#define DEFAULT_SERVE_CONNECTIONS 64
+#define DEFAULT_SERVE_IDLE_TIMEOUT "600000"
+#define MAX_REQUEST_SIZE ((uint_least32_t)1 << 20)
+#define MAX_REQUEST_HASHLEN 1024
+#define REQUEST_TIMEOUT_SEC 10
+
+#define REQUEST_HEADER_SIZE LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE
+#define RESPONSE_HEADER_SIZE LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE
+
+
+enum record_state {
+	RECORD_PENDING,
+	RECORD_DONE
+};
+
+struct record {
+	char *input;
+	char *output;
+	enum record_state state;
+};
+
+struct request {
+	struct request *next;
+	unsigned char *frame; /* including the header */
+	size_t size;
+	unsigned char header[RESPONSE_HEADER_SIZE];
+	unsigned char *tag;
+	size_t taglen;
+	pthread_cond_t cond;
+	int done;
+};
+
+/* Memory given to libar2 by a daemon worker, kept
+ * (erased) between hashes so that it stays warm */
+struct arena_block {
+	struct arena_block *next;
+	void *base;
+	size_t size;
+	size_t used;
+	size_t alignment;
+	int in_use;
+};
+
+struct serve_worker {
+	struct libar2_context ctx; /* must be first */
+	struct arena_block *blocks;
+};
+
+
+static const char *argv0 = "ar2simplified";
+
+static char *(*process)(char *input, size_t lineno, int *failedp);
+static const char *paramstr;
+static int delim = -1;
+static size_t jobs = 0;
+static size_t window = 0;
+
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_done_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ring_space_cond = PTHREAD_COND_INITIALIZER;
+static struct record *ring;
+static size_t ring_size;
+static size_t ring_read = 0;  /* number of records read */
+static size_t ring_work = 0;  /* number of records taken by workers */
+static size_t ring_write = 0; /* number of records written */
+static int ring_eof = 0;
+static int failed = 0;
+static struct libar2simplified_options record_options;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct request *queue_head = NULL;
+static struct request **queue_tail = &queue_head;
+static size_t queue_length = 0;
+static size_t serve_batch = DEFAULT_SERVE_BATCH;
+static uint_least32_t serve_max_memory = 0;
+static uint_least32_t serve_max_passes = 0;
+static uint_least32_t serve_max_lanes = 0;
+
+static pthread_mutex_t connections_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connections_cond = PTHREAD_COND_INITIALIZER;
+static size_t connections = 0;
+static size_t serve_max_connections = DEFAULT_SERVE_CONNECTIONS;
+
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s hash [-0 | -b] [-j jobs] [-w window] [params]\n", argv0);
+	fprintf(stderr, "       %s verify hash\n", argv0);
+	fprintf(stderr, "       %s verify (-0 | -b) [-j jobs] [-w window]\n", argv0);
+	fprintf(stderr, "       %s decode params\n", argv0);
+	fprintf(stderr, "       %s calibrate [-s] [-m kilobytes] [-p lanes] [-t milliseconds]\n", argv0);
+	fprintf(stderr, "       %s serve [-c connections] [-j jobs] [-m kilobytes] [-n batch] [-p lanes] [-t passes] [socket]\n", argv0);
+	exit(EXIT_ERROR);
+}
+
+
+static void
+eprintf(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	fprintf(stderr, "%s: ", argv0);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	exit(EXIT_ERROR);
+}
+
+
+static size_t
+parse_size(const char *s, size_t min)
+{
+	char *end;
+	unsigned long long int n;
+	errno = 0;
+	if (!isdigit(*s))
+		usage();
+	n = strtoull(s, &end, 10);
+	if (errno || *end || n < min || n > SIZE_MAX)
+		usage();
+	return (size_t)n;
+}
+
+
+static uint_least32_t
+parse_u32(const char *s, size_t min)
+{
+	size_t n = parse_size(s, min);
+	if (n > UINT_LEAST32_MAX)
+		usage();
+	return (uint_least32_t)n;
+}
+
+
+static char *
+read_password(void)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	len = getline(&line, &size, stdin);
+	if (len < 0) {
+		if (ferror(stdin))
+			eprintf("getline <stdin>: %s\n", strerror(errno));
+		len = 0;
+		if (!line && !(line = malloc(1)))
+			eprintf("malloc: %s\n", strerror(errno));
+	}
+	if (len && line[len - 1] == '\n')
+		len -= 1;
+	line[len] = '\0';
+	return line;
+}
+
+
+static int
+no_random_salt(char *out, size_t n)
+{
+	(void) out;
+	(void) n;
+	errno = EINVAL;
+	return -1;
+}
+
+
+static void *
+hash_message(char *msg, struct libar2_argon2_parameters *params, size_t *sizep)
+{
+	void *hash;
+
+	*sizep = libar2_hash_buf_size(params);
+	if (!*sizep || !(hash = malloc(*sizep))) {
+		libar2_erase(msg, strlen(msg));
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (libar2simplified_hash_opt(hash, msg, strlen(msg), params, &record_options)) {
+		free(hash);
+		return NULL;
+	}
+	return hash;
+}
+
+
+static char *
+hash_record(char *input, size_t lineno, int *failedp)
+{
+	struct libar2_argon2_parameters *params;
+	char *end, *ret = NULL;
+	void *hash = NULL;
+	size_t size = 0;
+
+	params = libar2simplified_decode(paramstr, NULL, &end, NULL);
+	if (!params) {
+		libar2_erase(input, strlen(input));
+	} else if (*end) {
+		libar2_erase(input, strlen(input));
+		errno = EINVAL;
+	} else if ((hash = hash_message(input, params, &size))) {
+		ret = libar2simplified_encode(params, hash);
+		libar2_erase(hash, size);
+	}
+	if (params)
+		libar2_erase(params->salt, params->saltlen);
+	free(params);
+	free(hash);
+
+	if (!ret) {
+		fprintf(stderr, "%s: record %zu: %s\n", argv0, lineno, strerror(errno));
+		*failedp = 1;
+		ret = strdup("");
+	}
+	return ret;
+}
+
+
+static int
+check_password(char *password, const char *hashstr)
+{
+	struct libar2_argon2_parameters *params;
+	char *tag, *end, *encoded = NULL;
+	void *hash = NULL;
+	size_t size = 0, taglen, i;
+	unsigned char diff = 0;
+	int ret = -1;
+
+	/* Like libar2simplified_verify, but with the options of the batch */
+	params = libar2simplified_decode(hashstr, &tag, &end, no_random_salt);
+	if (!params) {
+		libar2_erase(password, strlen(password));
+		return -1;
+	}
+	if (!tag || *end) {
+		libar2_erase(password, strlen(password));
+		errno = EINVAL;
+		goto out;
+	}
+	hash = hash_message(password, params, &size);
+	if (!hash)
+		goto out;
+	encoded = libar2simplified_encode_hash(params, hash);
+	if (!encoded)
+		goto out;
+
+	taglen = (size_t)(end - tag);
+	if (strlen(encoded) != taglen) {
+		ret = 0;
+		goto out;
+	}
+	for (i = 0; i < taglen; i++)
+		diff |= (unsigned char)(encoded[i] ^ tag[i]);
+	ret = !diff;
+
+out:
+	libar2_erase(params->salt, params->saltlen);
+	if (hash)
+		libar2_erase(hash, size);
+	if (encoded)
+		libar2_erase(encoded, strlen(encoded));
+	free(params);
+	free(hash);
+	free(encoded);
+	return ret;
+}
+
+
+static char *
+verify_record(char *input, size_t lineno, int *failedp)
+{
+	const char *verdict;
+	char *password;
+	int r;
+
+	/* Hash strings cannot contain colons, so the first
+	 * colon separates the hash from the password */
+	password = strchr(input, ':');
+	if (!password) {
+		fprintf(stderr, "%s: record %zu: missing ':'\n", argv0, lineno);
+		libar2_erase(input, strlen(input));
+		*failedp = 1;
+		return strdup("error");
+	}
+	*password++ = '\0';
+
+	r = check_password(password, input);
+	if (r < 0) {
+		fprintf(stderr, "%s: record %zu: %s\n", argv0, lineno, strerror(errno));
+		*failedp = 1;
+		verdict = "error";
+	} else {
+		verdict = r ? "match" : "mismatch";
+	}
+	return strdup(verdict);
+}
+
+
+static void *
+worker(void *data)
+{
+	struct record *record;
+	size_t index;
+	char *output;
+	int record_failed;
+
+	pthread_mutex_lock(&ring_mutex);
+	for (;;) {
+		while (ring_work == ring_read && !ring_eof)
+			pthread_cond_wait(&ring_work_cond, &ring_mutex);
+		if (ring_work == ring_read)
+			break;
+		index = ring_work++;
+		record = &ring[index % ring_size];
+		pthread_mutex_unlock(&ring_mutex);
+
+		record_failed = 0;
+		output = process(record->input, index + 1, &record_failed);
+		if (!output)
+			eprintf("strdup: %s\n", strerror(errno));
+
+		pthread_mutex_lock(&ring_mutex);
+		failed |= record_failed;
+		free(record->input);
+		record->input = NULL;
+		record->output = output;
+		record->state = RECORD_DONE;
+		pthread_cond_broadcast(&ring_done_cond);
+	}
+	pthread_mutex_unlock(&ring_mutex);
+
+	(void) data;
+	return NULL;
+}
+
+
+static void *
+writer(void *data)
+{
+	struct record *record;
+
+	pthread_mutex_lock(&ring_mutex);
+	for (;;) {
+		record = &ring[ring_write % ring_size];
+		if (ring_write == ring_read ? !ring_eof : record->state != RECORD_DONE) {
+			/* Nothing to write right now, so make sure
+			 * everything that has been written is seen */
+			pthread_mutex_unlock(&ring_mutex);
+			if (fflush(stdout))
+				eprintf("fflush <stdout>: %s\n", strerror(errno));
+			pthread_mutex_lock(&ring_mutex);
+			while (ring_write == ring_read ? !ring_eof : record->state != RECORD_DONE)
+				pthread_cond_wait(&ring_done_cond, &ring_mutex);
+		}
+		if (ring_write == ring_read)
+			break;
+		pthread_mutex_unlock(&ring_mutex);
+
+		if (fputs(record->output, stdout) == EOF || putchar(delim) == EOF)
+			eprintf("fputs <stdout>: %s\n", strerror(errno));
+		free(record->output);
+
+		pthread_mutex_lock(&ring_mutex);
+		record->output = NULL;
+		record->state = RECORD_PENDING;
+		ring_write += 1;
+		pthread_cond_signal(&ring_space_cond);
+	}
+	pthread_mutex_unlock(&ring_mutex);
+
+	(void) data;
+	return NULL;
+}
+
+
+static void
+parse_batch_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "0bj:w:")) != -1) {
+		switch (c) {
+		case '0':
+			delim = '\0';
+			break;
+		case 'b':
+			delim = '\n';
+			break;
+		case 'j':
+			jobs = parse_size(optarg, 1);
+			break;
+		case 'w':
+			window = parse_size(optarg, 1);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (delim < 0 && (jobs || window))
+		usage();
+}
+
+
+static int
+run_batch(void)
+{
+	pthread_t *workers, writer_thread;
+	struct record *record;
+	char *line = NULL;
+	size_t size = 0, i;
+	ssize_t len;
+	long int nproc;
+	int err;
+
+	if (!jobs) {
+		nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = nproc < 1 ? 1 : (size_t)nproc;
+	}
+	if (!window)
+		window = jobs > SIZE_MAX / 4 ? SIZE_MAX : jobs * 4;
+
+	/* Records are hashed in parallel, so a hash gets
+	 * one thread unless the user has specified otherwise */
+	if (jobs > 1 && !getenv("LIBAR2SIMPLIFIED_THREADS"))
+		record_options.max_threads = 1;
+
+	ring_size = window;
+	ring = calloc(ring_size, sizeof(*ring));
+	workers = calloc(jobs, sizeof(*workers));
+	if (!ring || !workers)
+		eprintf("calloc: %s\n", strerror(errno));
+
+	for (i = 0; i < jobs; i++)
+		if ((err = pthread_create(&workers[i], NULL, worker, NULL)))
+			eprintf("pthread_create: %s\n", strerror(err));
+	if ((err = pthread_create(&writer_thread, NULL, writer, NULL)))
+		eprintf("pthread_create: %s\n", strerror(err));
+
+	for (;;) {
+		len = getdelim(&line, &size, delim, stdin);
+		if (len < 0) {
+			if (ferror(stdin))
+				eprintf("getdelim <stdin>: %s\n", strerror(errno));
+			break;
+		}
+		if (len && line[len - 1] == (char)delim)
+			line[--len] = '\0';
+
+		pthread_mutex_lock(&ring_mutex);
+		while (ring_read - ring_write == ring_size)
+			pthread_cond_wait(&ring_space_cond, &ring_mutex);
+		record = &ring[ring_read % ring_size];
+		pthread_mutex_unlock(&ring_mutex);
+
+		record->input = strdup(line);
+		if (!record->input)
+			eprintf("strdup: %s\n", strerror(errno));
+		libar2_erase(line, (size_t)len);
+
+		pthread_mutex_lock(&ring_mutex);
+		ring_read += 1;
+		pthread_cond_signal(&ring_work_cond);
+		pthread_mutex_unlock(&ring_mutex);
+	}
+	if (line)
+		libar2_erase(line, size);
+	free(line);
+
+	pthread_mutex_lock(&ring_mutex);
+	ring_eof = 1;
+	pthread_cond_broadcast(&ring_work_cond);
+	pthread_cond_broadcast(&ring_done_cond);
+	pthread_mutex_unlock(&ring_mutex);
+
+	for (i = 0; i < jobs; i++)
+		pthread_join(workers[i], NULL);
+	pthread_join(writer_thread, NULL);
+
+	free(workers);
+	free(ring);
+	return failed ? EXIT_ERROR : 0;
+}
+
+
+static int
+hash_main(int argc, char *argv[])
+{
+	char *password, *hash;
+
+	parse_batch_options(argc, argv);
+	if (argc - optind > 1)
+		usage();
+	paramstr = optind < argc ? argv[optind] : libar2simplified_recommendation(0);
+	if (delim >= 0) {
+		process = hash_record;
+		return run_batch();
+	}
+
+	password = read_password();
+	hash = libar2simplified_crypt(password, paramstr, NULL);
+	free(password);
+	if (!hash)
+		eprintf("libar2simplified_crypt: %s\n", strerror(errno));
+	if (printf("%s\n", hash) < 0 || fflush(stdout))
+		eprintf("printf <stdout>: %s\n", strerror(errno));
+	free(hash);
+	return 0;
+}
+
+
+static int
+verify_main(int argc, char *argv[])
+{
+	char *password;
+	int r;
+
+	parse_batch_options(argc, argv);
+	if (delim >= 0) {
+		if (optind != argc)
+			usage();
+		process = verify_record;
+		return run_batch();
+	}
+	if (optind + 1 != argc)
+		usage();
+
+	password = read_password();
+	r = libar2simplified_verify(password, argv[optind], NULL);
+	free(password);
+	if (r < 0)
+		eprintf("libar2simplified_verify: %s\n", strerror(errno));
+	return r ? 0 : EXIT_MISMATCH;
+}
+
+
+static int
+decode_main(int argc, char *argv[])
+{
+	struct libar2_argon2_parameters *params;
+	char *tag, *end;
+
+	if (argc != 2)
+		usage();
+
+	params = libar2simplified_decode(argv[1], &tag, &end, NULL);
+	if (!params)
+		eprintf("libar2simplified_decode: %s\n", strerror(errno));
+	if (*end)
+		eprintf("libar2simplified_decode: %s\n", strerror(EINVAL));
+
+	printf("type %s\n", libar2_type_to_string(params->type, LIBAR2_LOWER_CASE));
+	printf("version %i\n", (int)params->version);
+	printf("m_cost %lu\n", (unsigned long int)params->m_cost);
+	printf("t_cost %lu\n", (unsigned long int)params->t_cost);
+	printf("lanes %lu\n", (unsigned long int)params->lanes);
+	printf("saltlen %zu\n", params->saltlen);
+	printf("hashlen %zu\n", params->hashlen);
+	if (tag)
+		printf("tag %.*s\n", (int)(end - tag), tag);
+	if (fflush(stdout))
+		eprintf("printf <stdout>: %s\n", strerror(errno));
+
+	libar2_erase(params->salt, params->saltlen);
+	free(params);
+	return 0;
+}
+
+
+static unsigned long int
+time_hash(int side_channel_free, uint_least32_t m_cost, uint_least32_t t_cost, size_t lanes)
+{
+	struct libar2_argon2_parameters *params;
+	struct timespec start, end;
+	char str[128], *hash;
+
+	snprintf(str, sizeof(str), "$%s$v=19$m=%lu,t=%lu,p=%zu$*16$*32",
+	         side_channel_free ? "argon2d" : "argon2id",
+	         (unsigned long int)m_cost, (unsigned long int)t_cost, lanes);
+	params = libar2simplified_decode(str, NULL, NULL, NULL);
+	if (!params)
+		eprintf("libar2simplified_decode %s: %s\n", str, strerror(errno));
+	hash = malloc(libar2_hash_buf_size(params));
+	if (!hash)
+		eprintf("malloc: %s\n", strerror(errno));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (libar2simplified_hash(hash, NULL, 0, params))
+		eprintf("libar2simplified_hash %s: %s\n", str, strerror(errno));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	free(hash);
+	free(params);
+	return (unsigned long int)((end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000L);
+}
+
+
+static int
+calibrate_main(int argc, char *argv[])
+{
+	unsigned long int target = DEFAULT_CALIBRATION_MSEC, max_memory = DEFAULT_CALIBRATION_MEMORY, ms;
+	uint_least32_t m_cost, t_cost = 1;
+	uint_least64_t next;
+	int side_channel_free = 0, c;
+	size_t lanes = 0;
+	long int nproc;
+
+	while ((c = getopt(argc, argv, "m:p:st:")) != -1) {
+		switch (c) {
+		case 'm':
+			max_memory = (unsigned long int)parse_size(optarg, 8);
+			break;
+		case 'p':
+			lanes = parse_size(optarg, 1);
+			break;
+		case 's':
+			side_channel_free = 1;
+			break;
+		case 't':
+			target = (unsigned long int)parse_size(optarg, 1);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	if (!lanes) {
+		nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		lanes = nproc < 1 ? 1 : nproc > 0xFFFFFFL ? 0xFFFFFF : (size_t)nproc;
+	}
+	if (max_memory > 0xFFFFFFFFUL)
+		max_memory = 0xFFFFFFFFUL;
+	if (max_memory < 8 * lanes)
+		eprintf("-m must be at least 8 times -p\n");
+
+	/* Use as much memory as allowed, reducing it only if a
+	 * single pass is too slow, then add passes until the
+	 * hash takes at least the target time */
+	m_cost = (uint_least32_t)max_memory;
+	while ((ms = time_hash(side_channel_free, m_cost, t_cost, lanes)) > target && m_cost / 2 >= 8 * lanes)
+		m_cost /= 2;
+	while (ms < target && t_cost < 0xFFFFFFFFUL) {
+		next = ms ? (uint_least64_t)t_cost * target / ms : (uint_least64_t)t_cost * 2;
+		if (next <= t_cost)
+			next = t_cost + 1;
+		t_cost = next > 0xFFFFFFFFUL ? (uint_least32_t)0xFFFFFFFFUL : (uint_least32_t)next;
+		ms = time_hash(side_channel_free, m_cost, t_cost, lanes);
+	}
+
+	if (printf("$%s$v=19$m=%lu,t=%lu,p=%zu$*16$*32\n", side_channel_free ? "argon2d" : "argon2id",
+	           (unsigned long int)m_cost, (unsigned long int)t_cost, lanes) < 0 || fflush(stdout))
+		eprintf("printf <stdout>: %s\n", strerror(errno));
+	return 0;
+}
+
+
+static void *
+arena_allocate(size_t num, size_t size, size_t alignment, struct libar2_context *ctx)
+{
+	struct serve_worker *w = (struct serve_worker *)ctx;
+	struct arena_block *block, *unused = NULL;
+	int err;
+
+	if (num > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size *= num;
+	if (alignment < sizeof(void *))
+		alignment = sizeof(void *);
+
+	for (block = w->blocks; block; block = block->next) {
+		if (block->in_use)
+			continue;
+		if (block->size >= size && block->alignment >= alignment)
+			goto out;
+		unused = block;
+	}
+
+	/* Replace a block that is too small rather than
+	 * growing the arena, unless all blocks are in use */
+	if (unused) {
+		block = unused;
+		free(block->base);
+		block->base = NULL;
+		block->size = 0;
+	} else {
+		block = calloc(1, sizeof(*block));
+		if (!block)
+			return NULL;
+		block->next = w->blocks;
+		w->blocks = block;
+	}
+	err = posix_memalign(&block->base, alignment, size);
+	if (err) {
+		block->base = NULL;
+		errno = err;
+		return NULL;
+	}
+	block->size = size;
+	block->alignment = alignment;
+
+out:
+	block->used = size;
+	block->in_use = 1;
+	return block->base;
+}
+
+
+static void
+arena_deallocate(void *ptr, struct libar2_context *ctx)
+{
+	struct serve_worker *w = (struct serve_worker *)ctx;
+	struct arena_block *block;
+	for (block = w->blocks; block->base != ptr; block = block->next);
+	libar2_erase(block->base, block->used);
+	block->in_use = 0;
+}
+
+
+static void
+serve_request(struct serve_worker *w, struct request *req)
+{
+	struct libar2_argon2_parameters *params;
+	const void *hash;
+	unsigned char *body = &req->frame[REQUEST_HEADER_SIZE];
+	size_t size = req->size - REQUEST_HEADER_SIZE, packlen;
+	uint_least32_t msglen, keylen, adlen;
+	int err = 0;
+
+	msglen = libar2simplified_internal_get_u32(&req->frame[4]);
+	keylen = libar2simplified_internal_get_u32(&req->frame[8]);
+	adlen = libar2simplified_internal_get_u32(&req->frame[12]);
+
+	params = libar2simplified_unpack(body, size, &hash, &packlen);
+	if (!params) {
+		err = errno;
+		goto out;
+	}
+	if (hash || !params->salt || (uint_least64_t)packlen + msglen + keylen + adlen != size) {
+		err = EINVAL;
+		goto out;
+	}
+	if (params->m_cost > serve_max_memory) {
+		err = ENOMEM;
+		goto out;
+	}
+	if (params->t_cost > serve_max_passes || params->lanes > serve_max_lanes) {
+		err = EPERM;
+		goto out;
+	}
+	if (params->hashlen > MAX_REQUEST_HASHLEN) {
+		err = EINVAL;
+		goto out;
+	}
+	params->key = keylen ? &body[packlen + msglen] : NULL;
+	params->keylen = keylen;
+	params->ad = adlen ? &body[packlen + msglen + keylen] : NULL;
+	params->adlen = adlen;
+
+	req->tag = malloc(libar2_hash_buf_size(params));
+	if (!req->tag) {
+		err = errno;
+		goto out;
+	}
+	if (libar2_hash(req->tag, &body[packlen], msglen, params, &w->ctx)) {
+		err = errno;
+		goto out;
+	}
+	req->taglen = params->hashlen;
+
+out:
+	if (err) {
+		free(req->tag);
+		req->tag = NULL;
+		req->taglen = 0;
+	}
+	libar2simplified_internal_put_u32(&req->header[0], (uint_least32_t)req->taglen);
+	libar2simplified_internal_put_u32(&req->header[4], (uint_least32_t)err);
+	free(params);
+}
+
+
+static void *
+serve_worker_loop(void *data)
+{
+	struct serve_worker *w = data;
+	struct request *batch, *req, *next;
+	size_t n;
+
+	pthread_mutex_lock(&queue_mutex);
+	for (;;) {
+		while (!queue_head)
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+
+		/* Take a share of the queue, so that queued requests are
+		 * coalesced into batches when there is a backlog, but
+		 * are spread over the workers when there is not */
+		n = (queue_length + jobs - 1) / jobs;
+		if (n > serve_batch)
+			n = serve_batch;
+		batch = req = queue_head;
+		queue_length -= 1;
+		while (--n && req->next) {
+			req = req->next;
+			queue_length -= 1;
+		}
+		queue_head = req->next;
+		if (!queue_head)
+			queue_tail = &queue_head;
+		req->next = NULL;
+		pthread_mutex_unlock(&queue_mutex);
+
+		for (req = batch; req; req = req->next)
+			serve_request(w, req);
+
+		pthread_mutex_lock(&queue_mutex);
+		for (req = batch; req; req = next) {
+			next = req->next;
+			req->done = 1;
+			pthread_cond_signal(&req->cond);
+		}
+	}
+
+	return NULL;
+}
+
+
+static void
+acquire_connection(void)
+{
+	pthread_mutex_lock(&connections_mutex);
+	while (connections >= serve_max_connections)
+		pthread_cond_wait(&connections_cond, &connections_mutex);
+	connections += 1;
+	pthread_mutex_unlock(&connections_mutex);
+}
+
+
+static void
+release_connection(void)
+{
+	pthread_mutex_lock(&connections_mutex);
+	connections -= 1;
+	pthread_cond_signal(&connections_cond);
+	pthread_mutex_unlock(&connections_mutex);
+}
+
+
+static void
+set_default_limits(void)
+{
+	struct libar2_argon2_parameters *params;
+	uint_least32_t m_cost = 0, t_cost = 0, lanes = 0;
+	long int nproc;
+	int side_channel_free;
+
+	/* Unless set on the command line, requests may not
+	 * cost more than the recommended parameters, so that a
+	 * client cannot exhaust the memory or the processors */
+	for (side_channel_free = 0; side_channel_free <= 1; side_channel_free++) {
+		params = libar2simplified_decode(libar2simplified_recommendation(side_channel_free), NULL, NULL, NULL);
+		if (!params)
+			eprintf("libar2simplified_decode: %s\n", strerror(errno));
+		if (params->m_cost > m_cost)
+			m_cost = params->m_cost;
+		if (params->t_cost > t_cost)
+			t_cost = params->t_cost;
+		if (params->lanes > lanes)
+			lanes = params->lanes;
+		free(params);
+	}
+	/* Parameters calibrated for this machine use one lane per processor */
+	nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nproc > (long int)lanes)
+		lanes = (uint_least32_t)nproc;
+
+	if (!serve_max_memory)
+		serve_max_memory = m_cost;
+	if (!serve_max_passes)
+		serve_max_passes = t_cost;
+	if (!serve_max_lanes)
+		serve_max_lanes = lanes;
+}
+
+
+static void *
+serve_connection(void *data)
+{
+	int fd = (int)(intptr_t)data;
+	struct request req;
+	struct timespec deadline;
+	uint_least32_t size;
+	unsigned char *frame;
+
+	memset(&req, 0, sizeof(req));
+	if (pthread_cond_init(&req.cond, NULL))
+		goto out;
+
+	for (;;) {
+		req.size = REQUEST_HEADER_SIZE;
+		req.frame = malloc(req.size);
+		/* The client may keep the connection idle between
+		 * requests, but once a request has begun, it must be
+		 * sent in full in time, so that stalled clients cannot
+		 * hold on to the connections forever */
+		if (!req.frame || libar2simplified_internal_recv_all(fd, req.frame, 1, NULL))
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += REQUEST_TIMEOUT_SEC;
+		if (libar2simplified_internal_recv_all(fd, &req.frame[1], REQUEST_HEADER_SIZE - 1, &deadline))
+			break;
+		size = libar2simplified_internal_get_u32(&req.frame[0]);
+		if (size > MAX_REQUEST_SIZE)
+			break;
+		frame = realloc(req.frame, REQUEST_HEADER_SIZE + (size_t)size);
+		if (!frame)
+			break;
+		req.frame = frame;
+		req.size = REQUEST_HEADER_SIZE + (size_t)size;
+		if (libar2simplified_internal_recv_all(fd, &req.frame[REQUEST_HEADER_SIZE], size, &deadline))
+			break;
+
+		pthread_mutex_lock(&queue_mutex);
+		req.done = 0;
+		req.next = NULL;
+		*queue_tail = &req;
+		queue_tail = &req.next;
+		queue_length += 1;
+		pthread_cond_signal(&queue_cond);
+		while (!req.done)
+			pthread_cond_wait(&req.cond, &queue_mutex);
+		pthread_mutex_unlock(&queue_mutex);
+
+		libar2_erase(req.frame, req.size);
+		free(req.frame);
+		req.frame = NULL;
+
+		if (libar2simplified_internal_send_all(fd, req.header, sizeof(req.header)) ||
+		    (req.tag && libar2simplified_internal_send_all(fd, req.tag, req.taglen)))
+			break;
+		if (req.tag) {
+			libar2_erase(req.tag, req.taglen);
+			free(req.tag);
+			req.tag = NULL;
+		}
+	}
+
+	if (req.frame) {
+		libar2_erase(req.frame, req.size);
+		free(req.frame);
+	}
+	if (req.tag) {
+		libar2_erase(req.tag, req.taglen);
+		free(req.tag);
+	}
+	pthread_cond_destroy(&req.cond);
+out:
+	close(fd);
+	release_connection();
+	return NULL;
+}
+
+
+#if defined(__GNUC__)
+__attribute__((__noreturn__))
+#endif
+static void
+serve_main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	struct serve_worker *workers;
+	struct stat st;
+	pthread_attr_t attr;
+	pthread_t thread;
+	const char *path;
+	long int nproc;
+	size_t i;
+	int fd, cfd, c, err;
+
+	while ((c = getopt(argc, argv, "c:j:m:n:p:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			serve_max_connections = parse_size(optarg, 1);
+			break;
+		case 'j':
+			jobs = parse_size(optarg, 1);
+			break;
+		case 'm':
+			serve_max_memory = parse_u32(optarg, 8);
+			break;
+		case 'n':
+			serve_batch = parse_size(optarg, 1);
+			break;
+		case 'p':
+			serve_max_lanes = parse_u32(optarg, 1);
+			break;
+		case 't':
+			serve_max_passes = parse_u32(optarg, 1);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind > 1)
+		usage();
+	path = optind < argc ? argv[optind] : getenv("LIBAR2SIMPLIFIED_SOCKET");
+	if (!path || !*path)
+		path = LIBAR2SIMPLIFIED_DEFAULT_SOCKET;
+
+	if (!jobs) {
+		nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = nproc < 1 ? 1 : (size_t)nproc;
+	}
+	set_default_limits();
+
+	/* Keep the pool threads around between requests,
+	 * unless the user has specified otherwise */
+	setenv("LIBAR2SIMPLIFIED_IDLE_TIMEOUT", DEFAULT_SERVE_IDLE_TIMEOUT, 0);
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		eprintf("%s: %s\n", path, strerror(ENAMETOOLONG));
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		eprintf("socket: %s\n", strerror(errno));
+	/* Remove a stale socket, but nothing else */
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if (bind(fd, (const void *)&addr, (socklen_t)sizeof(addr)))
+		eprintf("bind %s: %s\n", path, strerror(errno));
+	if (listen(fd, SOMAXCONN))
+		eprintf("listen %s: %s\n", path, strerror(errno));
+
+	if ((err = pthread_attr_init(&attr)))
+		eprintf("pthread_attr_init: %s\n", strerror(err));
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	workers = calloc(jobs, sizeof(*workers));
+	if (!workers)
+		eprintf("calloc: %s\n", strerror(errno));
+	for (i = 0; i < jobs; i++) {
+		libar2simplified_init_context(&workers[i].ctx);
+		workers[i].ctx.allocate = arena_allocate;
+		workers[i].ctx.deallocate = arena_deallocate;
+		if ((err = pthread_create(&thread, &attr, serve_worker_loop, &workers[i])))
+			eprintf("pthread_create: %s\n", strerror(err));
+	}
+
+	for (;;) {
+		/* Further clients wait in the listen queue */
+		acquire_connection();
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0) {
+			err = errno;
+			release_connection();
+			if (err == EINTR || err == ECONNABORTED)
+				continue;
+			fprintf(stderr, "%s: accept: %s\n", argv0, strerror(err));
+			if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+				sleep(1);
+			continue;
+		}
+		if ((err = pthread_create(&thread, &attr, serve_connection, (void *)(intptr_t)cfd))) {
+			fprintf(stderr, "%s: pthread_create: %s\n", argv0, strerror(err));
+			close(cfd);
+			release_connection();
+		}
+	}
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	if (argc)
+		argv0 = argv[0];
+	if (argc < 2)
+		usage();
+
+	argc -= 1;
+	argv += 1;
+	if (!strcmp(argv[0], "hash"))
+		return hash_main(argc, argv);
+	if (!strcmp(argv[0], "verify"))
+		return verify_main(argc, argv);
+	if (!strcmp(argv[0], "decode"))
+		return decode_main(argc, argv);
+	if (!strcmp(argv[0], "calibrate"))
+		return calibrate_main(argc, argv);
+	if (!strcmp(argv[0], "serve"))
+		serve_main(argc, argv);
+	usage();
+	return EXIT_ERROR;
+}
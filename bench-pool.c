@@ -0,0 +1,312 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <math.h>
+#include <time.h>
+
+
+#define DEFAULT_ROUNDS 200UL
+
+/* Long enough to keep a worker busy while the
+ * others are dispatched, short enough to keep
+ * the run time of the harness down */
+#define FIXED_DURATION_NS 50000U
+
+
+/* Drives the thread pool callbacks directly, the way libar2_hash
+ * does: each round, every worker is given one task (segment) and
+ * the round is joined before the next one is dispatched */
+struct benchmark {
+	const char *kind;
+	size_t workers;
+	size_t contexts; /* concurrent contexts, each with its own pool and thread */
+	uint_least64_t duration; /* of each task, in nanoseconds */
+};
+
+static const struct benchmark benchmarks[] = {
+	{"noop", 2, 1, 0},
+	{"noop", 4, 1, 0},
+	{"noop", 8, 1, 0},
+	{"noop", 16, 1, 0},
+	{"noop", 64, 1, 0},
+	{"noop", 256, 1, 0},
+	{"fixed", 2, 1, FIXED_DURATION_NS},
+	{"fixed", 8, 1, FIXED_DURATION_NS},
+	{"fixed", 64, 1, FIXED_DURATION_NS},
+	{"fixed", 256, 1, FIXED_DURATION_NS},
+	{"noop", 8, 4, 0},
+	{"noop", 8, 16, 0},
+	{"noop", 64, 4, 0},
+	{"fixed", 8, 16, FIXED_DURATION_NS}
+};
+
+
+struct task {
+	struct bench_context *owner;
+	uint_least64_t dispatched;
+	uint_least64_t started;
+};
+
+struct bench_context {
+	struct libar2_context ctx;
+	const struct benchmark *benchmark;
+	struct task *tasks;
+	size_t *indices;
+	uint_least64_t *latencies;
+	size_t nlatencies;
+	size_t created;
+	atomic_size_t completed;
+	uint_least64_t start;
+	uint_least64_t end;
+	const char *failure;
+	int error;
+};
+
+
+static unsigned long int rounds = DEFAULT_ROUNDS;
+static int failed = 0;
+
+
+static uint_least64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint_least64_t)ts.tv_sec * 1000000000ULL + (uint_least64_t)ts.tv_nsec;
+}
+
+
+static void
+task_function(void *data)
+{
+	struct task *task = data;
+	uint_least64_t duration = task->owner->benchmark->duration;
+
+	task->started = now_ns();
+	if (duration)
+		while (now_ns() - task->started < duration);
+	atomic_fetch_add_explicit(&task->owner->completed, 1, memory_order_relaxed);
+}
+
+
+static int
+run_round(struct bench_context *bc)
+{
+	struct libar2_context *ctx = &bc->ctx;
+	size_t i, n, dispatched = 0;
+	struct task *task;
+
+	while (dispatched < bc->created) {
+		n = ctx->get_ready_threads(bc->indices, bc->created, ctx);
+		if (!n)
+			return -1;
+		for (i = 0; i < n && dispatched < bc->created; i++, dispatched++) {
+			task = &bc->tasks[bc->indices[i]];
+			task->started = 0;
+			task->dispatched = now_ns();
+			if (ctx->run_thread(bc->indices[i], task_function, task, ctx))
+				return -1;
+		}
+	}
+	if (ctx->join_thread_pool(ctx))
+		return -1;
+
+	/* Everything dispatched must have been run by the time the
+	 * round is joined, as libar2 reads the segments' output */
+	for (i = 0; i < bc->created; i++) {
+		if (!bc->tasks[i].started) {
+			bc->failure = "task not run before join";
+			return 0;
+		}
+		bc->latencies[bc->nlatencies++] = bc->tasks[i].started - bc->tasks[i].dispatched;
+	}
+	return 0;
+}
+
+
+static void *
+run_context(void *data)
+{
+	struct bench_context *bc = data;
+	struct libar2simplified_options opts;
+	unsigned long int round;
+	size_t i, workers = bc->benchmark->workers;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.max_threads = workers;
+	opts.oversubscribe = 1;
+
+	if (libar2simplified_init_context_opt(&bc->ctx, &opts)) {
+		bc->error = errno;
+		return NULL;
+	}
+	if (bc->ctx.init_thread_pool(workers, &bc->created, &bc->ctx)) {
+		bc->error = errno;
+		goto out;
+	}
+	if (!bc->created) {
+		bc->failure = "no thread pool";
+		goto out;
+	}
+
+	bc->tasks = calloc(bc->created, sizeof(*bc->tasks));
+	bc->indices = calloc(bc->created, sizeof(*bc->indices));
+	bc->latencies = calloc(bc->created * rounds, sizeof(*bc->latencies));
+	if (!bc->tasks || !bc->indices || !bc->latencies) {
+		bc->error = ENOMEM;
+		goto destroy;
+	}
+	for (i = 0; i < bc->created; i++)
+		bc->tasks[i].owner = bc;
+
+	bc->start = now_ns();
+	for (round = 0; round < rounds && !bc->failure; round++) {
+		if (run_round(bc)) {
+			bc->error = errno;
+			goto destroy;
+		}
+	}
+	bc->end = now_ns();
+
+	if (!bc->failure && atomic_load(&bc->completed) != bc->created * rounds)
+		bc->failure = "completions lost";
+
+destroy:
+	if (bc->ctx.destroy_thread_pool(&bc->ctx) && !bc->error)
+		bc->error = errno;
+out:
+	libar2simplified_destroy_context(&bc->ctx);
+	return NULL;
+}
+
+
+static int
+cmp_u64(const void *a_, const void *b_)
+{
+	const uint_least64_t *a = a_, *b = b_;
+	return *a < *b ? -1 : *a > *b;
+}
+
+
+static void
+report(const struct benchmark *b, struct bench_context *bcs)
+{
+	uint_least64_t *latencies, start = UINT_LEAST64_MAX, end = 0;
+	size_t i, n = 0, created = 0, completed = 0;
+	const char *failure = NULL;
+	double mean = 0, variance = 0, d;
+
+	for (i = 0; i < b->contexts; i++) {
+		if (bcs[i].error) {
+			fprintf(stderr, "%s, %zu workers, %zu contexts: %s\n",
+			        b->kind, b->workers, b->contexts, strerror(bcs[i].error));
+			exit(2);
+		}
+		if (bcs[i].failure && !failure)
+			failure = bcs[i].failure;
+		n += bcs[i].nlatencies;
+		created += bcs[i].created;
+		completed += atomic_load(&bcs[i].completed);
+		if (bcs[i].start < start)
+			start = bcs[i].start;
+		if (bcs[i].end > end)
+			end = bcs[i].end;
+	}
+
+	latencies = calloc(n ? n : 1, sizeof(*latencies));
+	if (!latencies) {
+		perror("calloc");
+		exit(2);
+	}
+	for (n = 0, i = 0; i < b->contexts; i++) {
+		memcpy(&latencies[n], bcs[i].latencies, bcs[i].nlatencies * sizeof(*latencies));
+		n += bcs[i].nlatencies;
+	}
+	qsort(latencies, n, sizeof(*latencies), cmp_u64);
+
+	/* The jitter is the standard deviation of the dispatch-to-start latency */
+	for (i = 0; i < n; i++)
+		mean += (double)latencies[i];
+	mean /= n ? (double)n : 1;
+	for (i = 0; i < n; i++) {
+		d = (double)latencies[i] - mean;
+		variance += d * d;
+	}
+	variance /= n ? (double)n : 1;
+
+	if (failure)
+		failed = 1;
+	printf("%-5s %4zu workers %3zu contexts %9.0f ns p50 %9.0f ns p99 %10.0f ns max %9.0f ns jitter %10.0f tasks/s",
+	       b->kind, b->workers, b->contexts,
+	       n ? (double)latencies[n / 2] : 0.0,
+	       n ? (double)latencies[n - n / 100 - 1] : 0.0,
+	       n ? (double)latencies[n - 1] : 0.0,
+	       sqrt(variance),
+	       end > start ? (double)completed * 1e9 / (double)(end - start) : 0.0);
+	if (created != b->workers * b->contexts)
+		printf("  (%zu threads)", created);
+	if (failure)
+		printf("  FAIL: %s", failure);
+	printf("\n");
+
+	free(latencies);
+}
+
+
+static void
+bench(const struct benchmark *b)
+{
+	struct bench_context *bcs;
+	pthread_t *threads;
+	size_t i;
+	int err;
+
+	bcs = calloc(b->contexts, sizeof(*bcs));
+	threads = calloc(b->contexts, sizeof(*threads));
+	if (!bcs || !threads) {
+		perror("calloc");
+		exit(2);
+	}
+	for (i = 0; i < b->contexts; i++)
+		bcs[i].benchmark = b;
+
+	if (b->contexts == 1) {
+		run_context(&bcs[0]);
+	} else {
+		for (i = 0; i < b->contexts; i++) {
+			if ((err = pthread_create(&threads[i], NULL, run_context, &bcs[i]))) {
+				fprintf(stderr, "pthread_create: %s\n", strerror(err));
+				exit(2);
+			}
+		}
+		for (i = 0; i < b->contexts; i++)
+			pthread_join(threads[i], NULL);
+	}
+
+	report(b, bcs);
+
+	for (i = 0; i < b->contexts; i++) {
+		free(bcs[i].tasks);
+		free(bcs[i].indices);
+		free(bcs[i].latencies);
+	}
+	free(threads);
+	free(bcs);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	size_t i;
+	char *end;
+
+	if (argc > 2 || (argc == 2 && (!isdigit(*argv[1]) || !(rounds = strtoul(argv[1], &end, 10)) || *end))) {
+		fprintf(stderr, "usage: %s [rounds]\n", argc ? argv[0] : "bench-pool");
+		return 2;
+	}
+
+	for (i = 0; i < sizeof(benchmarks) / sizeof(*benchmarks); i++)
+		bench(&benchmarks[i]);
+
+	return failed;
+}
@@ -0,0 +1,259 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <time.h>
+
+
+#define DEFAULT_ITERATIONS 100000UL
+
+
+struct benchmark {
+	const char *function;
+	const char *input;
+	/* Maximum number of allocations per operation, including
+	 * those made by libar2; exceeding it is reported as a
+	 * failure, as is not freeing everything that is allocated */
+	size_t max_allocs;
+};
+
+
+static const struct benchmark decode_benchmarks[] = {
+	{"decode_r", "$argon2id$v=19$m=3072,t=32,p=4$*16$*48", 3},
+	{"decode_r", "$argon2d$v=16$m=8,t=1,p=1$*8$*100", 3},
+	{"decode_r", "$argon2i$m=4096,t=3,p=1$fn5/f35+f38$9tqKA4WMEsSAOEUwatjxvJLSqL1j0GQkgbsfnpresDw", 2},
+	{"decode_r", "$argon2d$v=16$m=8,t=1,p=1$ICAgICAgICA$"
+	             "NjODMrWrS7zeivNNpHsuxD9c6uDmUQ6YqPRhb8H5DSNw9n683FUCJZ3tyxgfJpYYANI"
+	             "+01WT/S5zp1UVs+qNRwnkdEyLKZMg+DIOXVc9z1po9ZlZG8+Gp4g5brqfza3lvkR9vw", 2}
+};
+
+static const struct benchmark encode_benchmarks[] = {
+	{"encode", "$argon2id$v=19$m=3072,t=32,p=4$*16$*48", 1},
+	{"encode", "$argon2i$m=4096,t=3,p=1$fn5/f35+f38$9tqKA4WMEsSAOEUwatjxvJLSqL1j0GQkgbsfnpresDw", 1},
+	{"encode", "$argon2d$v=16$m=8,t=1,p=1$*8$*100", 1}
+};
+
+static const struct benchmark encode_hash_benchmarks[] = {
+	{"encode_hash", "$argon2id$v=19$m=3072,t=32,p=4$*16$*48", 1},
+	{"encode_hash", "$argon2d$v=16$m=8,t=1,p=1$*8$*100", 1}
+};
+
+/* The smallest possible hashing costs, so that
+ * the string processing is not drowned out */
+static const struct benchmark crypt_benchmarks[] = {
+	{"crypt", "$argon2id$v=19$m=8,t=1,p=1$*16$*32", 6},
+	{"crypt", "$argon2d$v=16$m=8,t=1,p=1$*8$*100", 6},
+	{"crypt", "$argon2i$v=19$m=8,t=1,p=1$fn5/f35+f38$*32", 5}
+};
+
+
+static atomic_size_t allocs = 0;
+static atomic_size_t frees = 0;
+static unsigned long int iterations = DEFAULT_ITERATIONS;
+static int failed = 0;
+
+
+/* Count allocations by interposing the allocator */
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t n);
+extern void *__libc_memalign(size_t alignment, size_t n);
+extern void __libc_free(void *ptr);
+
+void *
+malloc(size_t n)
+{
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __libc_malloc(n);
+}
+
+void *
+calloc(size_t num, size_t size)
+{
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __libc_calloc(num, size);
+}
+
+void *
+realloc(void *ptr, size_t n)
+{
+	if (!ptr)
+		atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	return __libc_realloc(ptr, n);
+}
+
+int
+posix_memalign(void **ptrp, size_t alignment, size_t n)
+{
+	void *ptr = __libc_memalign(alignment, n);
+	if (!ptr)
+		return ENOMEM;
+	atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+	*ptrp = ptr;
+	return 0;
+}
+
+void
+free(void *ptr)
+{
+	if (ptr)
+		atomic_fetch_add_explicit(&frees, 1, memory_order_relaxed);
+	__libc_free(ptr);
+}
+
+# define COUNTING_ALLOCATIONS 1
+#else
+# define COUNTING_ALLOCATIONS 0
+#endif
+
+
+static int
+fake_random(char *out, size_t n, void *user_data)
+{
+	size_t *counter = user_data;
+	while (n--)
+		*out++ = (char)((*counter)++ & 63);
+	return 0;
+}
+
+
+static uint_least64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint_least64_t)ts.tv_sec * 1000000000ULL + (uint_least64_t)ts.tv_nsec;
+}
+
+
+static void
+report(const struct benchmark *b, uint_least64_t start, uint_least64_t end, size_t alloc0, size_t free0)
+{
+	double allocs_per_op = (double)(atomic_load(&allocs) - alloc0) / (double)iterations;
+	double frees_per_op = (double)(atomic_load(&frees) - free0) / (double)iterations;
+	const char *verdict = "";
+
+	if (COUNTING_ALLOCATIONS && (allocs_per_op > (double)b->max_allocs || allocs_per_op != frees_per_op)) {
+		verdict = "  FAIL";
+		failed = 1;
+	}
+	printf("%-12s %10.1f ns/op %6.2f allocs/op %6.2f frees/op%s  %s\n",
+	       b->function, (double)(end - start) / (double)iterations,
+	       allocs_per_op, frees_per_op, verdict, b->input);
+}
+
+
+static struct libar2_argon2_parameters *
+decode(const char *str)
+{
+	size_t counter = 0;
+	struct libar2_argon2_parameters *params;
+	params = libar2simplified_decode_r(str, NULL, NULL, fake_random, &counter);
+	if (!params) {
+		fprintf(stderr, "libar2simplified_decode_r %s: %s\n", str, strerror(errno));
+		exit(2);
+	}
+	return params;
+}
+
+
+static void
+bench_decode(const struct benchmark *b)
+{
+	struct libar2_argon2_parameters *params;
+	size_t alloc0, free0, counter = 0;
+	uint_least64_t start, end;
+	unsigned long int i;
+
+	alloc0 = atomic_load(&allocs);
+	free0 = atomic_load(&frees);
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		params = libar2simplified_decode_r(b->input, NULL, NULL, fake_random, &counter);
+		if (!params) {
+			fprintf(stderr, "libar2simplified_decode_r %s: %s\n", b->input, strerror(errno));
+			exit(2);
+		}
+		free(params);
+	}
+	end = now_ns();
+	report(b, start, end, alloc0, free0);
+}
+
+
+static void
+bench_encode(const struct benchmark *b, char *(*encode)(const struct libar2_argon2_parameters *, void *))
+{
+	struct libar2_argon2_parameters *params = decode(b->input);
+	unsigned char hash[256];
+	size_t alloc0, free0;
+	uint_least64_t start, end;
+	unsigned long int i;
+	char *str;
+
+	memset(hash, 0xA5, sizeof(hash));
+	alloc0 = atomic_load(&allocs);
+	free0 = atomic_load(&frees);
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		str = encode(params, hash);
+		if (!str) {
+			fprintf(stderr, "libar2simplified_%s %s: %s\n", b->function, b->input, strerror(errno));
+			exit(2);
+		}
+		free(str);
+	}
+	end = now_ns();
+	report(b, start, end, alloc0, free0);
+	free(params);
+}
+
+
+static void
+bench_crypt(const struct benchmark *b)
+{
+	size_t alloc0, free0;
+	uint_least64_t start, end;
+	unsigned long int i;
+	char pwd[sizeof("password")], *str;
+
+	alloc0 = atomic_load(&allocs);
+	free0 = atomic_load(&frees);
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memcpy(pwd, "password", sizeof(pwd));
+		str = libar2simplified_crypt(pwd, b->input, NULL);
+		if (!str) {
+			fprintf(stderr, "libar2simplified_crypt %s: %s\n", b->input, strerror(errno));
+			exit(2);
+		}
+		free(str);
+	}
+	end = now_ns();
+	report(b, start, end, alloc0, free0);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	size_t i;
+	char *end;
+
+	if (argc > 2 || (argc == 2 && (!isdigit(*argv[1]) || !(iterations = strtoul(argv[1], &end, 10)) || *end))) {
+		fprintf(stderr, "usage: %s [iterations]\n", argc ? argv[0] : "bench-string");
+		return 2;
+	}
+
+	for (i = 0; i < sizeof(decode_benchmarks) / sizeof(*decode_benchmarks); i++)
+		bench_decode(&decode_benchmarks[i]);
+	for (i = 0; i < sizeof(encode_benchmarks) / sizeof(*encode_benchmarks); i++)
+		bench_encode(&encode_benchmarks[i], libar2simplified_encode);
+	for (i = 0; i < sizeof(encode_hash_benchmarks) / sizeof(*encode_hash_benchmarks); i++)
+		bench_encode(&encode_hash_benchmarks[i], libar2simplified_encode_hash);
+	for (i = 0; i < sizeof(crypt_benchmarks) / sizeof(*crypt_benchmarks); i++)
+		bench_crypt(&crypt_benchmarks[i]);
+
+	if (!COUNTING_ALLOCATIONS)
+		fprintf(stderr, "%s: allocations are only counted with glibc\n", argc ? argv[0] : "bench-string");
+	return failed;
+}
@@ -4,6 +4,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +13,12 @@
 
 #include <libar2.h>
 
+#if !defined(NO_SDT) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+# endif
+#endif
+
 
 #ifndef ALIGNOF
 # ifdef __STDC_VERSION__
@@ -28,10 +36,80 @@
 #endif
 
 
+#if defined(__GNUC__)
+# define HIDDEN __attribute__((__visibility__("hidden")))
+#else
+# define HIDDEN
+#endif
+
+
+#ifdef STAP_PROBE
+# define TRACE(NAME) STAP_PROBE(libar2simplified, NAME)
+# define TRACE1(NAME, A) STAP_PROBE1(libar2simplified, NAME, A)
+# define TRACE2(NAME, A, B) STAP_PROBE2(libar2simplified, NAME, A, B)
+# define TRACE3(NAME, A, B, C) STAP_PROBE3(libar2simplified, NAME, A, B, C)
+# define TRACE4(NAME, A, B, C, D) STAP_PROBE4(libar2simplified, NAME, A, B, C, D)
+#else
+# define TRACE(NAME) ((void)0)
+# define TRACE1(NAME, A) ((void)0)
+# define TRACE2(NAME, A, B) ((void)0)
+# define TRACE3(NAME, A, B, C) ((void)0)
+# define TRACE4(NAME, A, B, C, D) ((void)0)
+#endif
+
+
 #ifndef FALLBACK_NPROC
 # define FALLBACK_NPROC 4
 #endif
 
+#ifndef ASYNC_ERASE_THRESHOLD
+# define ASYNC_ERASE_THRESHOLD ((size_t)64 << 10)
+#endif
+#ifndef ASYNC_ERASE_MAX_PENDING
+# define ASYNC_ERASE_MAX_PENDING ((size_t)1 << 30)
+#endif
+
+/* Smaller allocations are not backed by a file
+ * even if `.matrix_directory` has been set */
+#ifndef MIN_FILE_BACKED_SIZE
+# define MIN_FILE_BACKED_SIZE ((size_t)1 << 20)
+#endif
+
+/* With LIBAR2SIMPLIFIED_PRESSURE set, the pressure stall
+ * information is sampled at most this often, in milliseconds;
+ * when the share of time, in hundredths of a percent, that
+ * some tasks were stalled, averaged over 10 seconds, reaches
+ * the high mark, the limits are halved, and when it is below
+ * the low mark, the limits are raised again step by step */
+#ifndef PRESSURE_SAMPLE_INTERVAL
+# define PRESSURE_SAMPLE_INTERVAL 1000
+#endif
+#ifndef PRESSURE_MEMORY_HIGH
+# define PRESSURE_MEMORY_HIGH 1000
+#endif
+#ifndef PRESSURE_MEMORY_LOW
+# define PRESSURE_MEMORY_LOW 100
+#endif
+#ifndef PRESSURE_CPU_HIGH
+# define PRESSURE_CPU_HIGH 2500
+#endif
+#ifndef PRESSURE_CPU_LOW
+# define PRESSURE_CPU_LOW 500
+#endif
+
+/* Smaller allocations are not counted as memory matrices
+ * by the pressure governor, they cannot make a difference */
+#ifndef MIN_GOVERNED_SIZE
+# define MIN_GOVERNED_SIZE ((size_t)1 << 20)
+#endif
+
+/* Hashes with fewer memory blocks (kilobytes) per lane
+ * than this are not split over threads, as dispatching
+ * the segments would cost more than computing them */
+#ifndef MIN_PARALLEL_LANE_BLOCKS
+# define MIN_PARALLEL_LANE_BLOCKS 256
+#endif
+
 
 #ifndef RECOMMENDATION_SIDE_CHANNEL_ENVIRONMENT
 # define RECOMMENDATION_SIDE_CHANNEL_ENVIRONMENT "$argon2id$v=19$m=3072,t=32,p=4$*16$*48"
@@ -39,3 +117,104 @@
 #ifndef RECOMMENDATION_SIDE_CHANNEL_FREE_ENVIRONMENT
 # define RECOMMENDATION_SIDE_CHANNEL_FREE_ENVIRONMENT "$argon2d$v=19$m=3072,t=32,p=4$*16$*48"
 #endif
+
+
+struct thread_pool;
+
+/* What `.user_data` in a context from `libar2simplified_init_context` points to;
+ * it is `NULL` until the thread pool is created, unless set by the library itself */
+struct context_data {
+	struct libar2simplified_options options;
+	struct thread_pool *pool;
+	size_t lane_blocks; /* memory blocks per lane, 0 if unknown */
+	struct libar2simplified_hash_state *stepper; /* if calculated stepwise */
+	unsigned char free_with_pool;
+	unsigned char count_serial; /* count a serial calculation as busy, until libar2simplified_internal_serial_done */
+	unsigned char serial; /* counted as busy */
+};
+
+
+#define PACK_FLAG_SALT 1
+#define PACK_FLAG_TAG 2
+
+
+/* BLAKE2b personalisation, exactly 16 bytes, for
+ * libar2simplified_derive_keys's subkey expansion */
+#define SUBKEY_PERSONALISATION "libar2simplified"
+/* The shortest Argon2 hash keys may be derived from */
+#define MIN_SUBKEY_TAG_SIZE 32
+/* BLAKE2b's limit on both the key and the digest */
+#define MAX_SUBKEY_SIZE 64
+
+
+#define VERIFY_CACHE_MAC_SIZE 32
+#define VERIFY_CACHE_KEY_SIZE 64
+#define VERIFY_CACHE_NONE SIZE_MAX
+
+struct verify_cache_entry {
+	unsigned char mac[VERIFY_CACHE_MAC_SIZE];
+	uint_least64_t expires; /* CLOCK_MONOTONIC, in milliseconds */
+	size_t chain; /* next in bucket, or in free list */
+	size_t newer;
+	size_t older;
+	unsigned char verdict;
+};
+
+struct libar2simplified_verify_cache {
+	pthread_mutex_t mutex;
+	unsigned char key[VERIFY_CACHE_KEY_SIZE];
+	uint_least64_t ttl;
+	size_t capacity;
+	size_t free;
+	size_t newest;
+	size_t oldest;
+	size_t mask; /* number of buckets less 1 */
+	size_t *buckets;
+	struct verify_cache_entry *entries;
+};
+
+
+struct stats {
+	atomic_uint_least64_t hashes_completed;
+	atomic_uint_least64_t hashes_failed;
+	atomic_uint_least64_t bytes_allocated;
+	atomic_uint_least64_t bytes_allocated_peak;
+	atomic_uint_least64_t pool_threads;
+	atomic_uint_least64_t queue_depth;
+	atomic_uint_least64_t idle_threads;
+	atomic_uint_least64_t latency[LIBAR2SIMPLIFIED_STATS_CLASSES][LIBAR2SIMPLIFIED_STATS_BUCKETS];
+	atomic_uint_least64_t hashes_degraded;
+};
+
+/* libar2simplified_stats_snapshot.c */
+extern HIDDEN struct stats libar2simplified_internal_stats;
+#define STATS_ADD(FIELD, N) atomic_fetch_add_explicit(&libar2simplified_internal_stats.FIELD, (N), memory_order_relaxed)
+#define STATS_SUB(FIELD, N) atomic_fetch_sub_explicit(&libar2simplified_internal_stats.FIELD, (N), memory_order_relaxed)
+HIDDEN void libar2simplified_internal_stats_allocated(size_t n);
+HIDDEN void libar2simplified_internal_stats_hash(const struct libar2_argon2_parameters *params, uint_least64_t microseconds, int failed);
+
+/* libar2simplified_hash_opt.c */
+HIDDEN int libar2simplified_internal_hash(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                                          const struct libar2simplified_options *opts,
+                                          struct libar2simplified_hash_state *stepper);
+
+/* libar2simplified_hash_step.c */
+HIDDEN int libar2simplified_internal_step_yield(struct libar2simplified_hash_state *state);
+HIDDEN int libar2simplified_internal_step_pause(struct libar2simplified_hash_state *state);
+
+/* libar2simplified_init_context.c */
+HIDDEN int libar2simplified_internal_check_cancelled(const struct libar2simplified_options *opts);
+HIDDEN void libar2simplified_internal_serial_done(struct context_data *cdata);
+
+/* libar2simplified_pack.c */
+HIDDEN void libar2simplified_internal_put_u32(unsigned char *buf, uint_least32_t value);
+
+/* libar2simplified_remote_hash.c */
+HIDDEN int libar2simplified_internal_send_all(int fd, const void *buf, size_t len);
+HIDDEN int libar2simplified_internal_recv_all(int fd, void *buf, size_t len, const struct timespec *deadline);
+
+/* libar2simplified_unpack.c */
+HIDDEN uint_least32_t libar2simplified_internal_get_u32(const unsigned char *buf);
+
+/* libar2simplified_verify_cache_create.c */
+HIDDEN int libar2simplified_internal_random_key(unsigned char *out, size_t n);
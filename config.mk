@@ -2,7 +2,9 @@ PREFIX    = /usr
 MANPREFIX = $(PREFIX)/share/man
 
 CC = cc
+CXX = c++
 
 CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_XOPEN_SOURCE=700 -D_GNU_SOURCE
 CFLAGS   = -std=c11 -Wall -g -pthread
+CXXFLAGS = -std=c++17 -Wall -g -pthread
 LDFLAGS  = -lar2 -lblake -pthread
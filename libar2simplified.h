@@ -3,6 +3,286 @@
 #define LIBAR2SIMPLIFIED_H
 
 #include <libar2.h>
+#include <signal.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/**
+ * The number of parameter classes in
+ * `struct libar2simplified_stats`
+ */
+#define LIBAR2SIMPLIFIED_STATS_CLASSES 4
+
+/**
+ * The number of latency buckets per parameter
+ * class in `struct libar2simplified_stats`
+ */
+#define LIBAR2SIMPLIFIED_STATS_BUCKETS 32
+
+/**
+ * Process-wide counters, see `libar2simplified_stats_snapshot`
+ */
+struct libar2simplified_stats {
+	/**
+	 * The number of successfully completed hashes
+	 */
+	uint_least64_t hashes_completed;
+
+	/**
+	 * The number of failed hashes
+	 */
+	uint_least64_t hashes_failed;
+
+	/**
+	 * The number of bytes currently allocated by contexts,
+	 * including memory waiting to be erased
+	 */
+	uint_least64_t bytes_allocated;
+
+	/**
+	 * The greatest value `bytes_allocated` has had
+	 */
+	uint_least64_t bytes_allocated_peak;
+
+	/**
+	 * The number of live threads assigned to thread pools
+	 */
+	uint_least64_t pool_threads;
+
+	/**
+	 * The number of segments dispatched to threads
+	 * in thread pools that have not been completed
+	 */
+	uint_least64_t queue_depth;
+
+	/**
+	 * The number of idle threads waiting to be
+	 * assigned to a thread pool
+	 */
+	uint_least64_t idle_threads;
+
+	/**
+	 * Latency histograms; `latency[c][b]` is the number of
+	 * hashes, completed or failed, with a memory cost in
+	 * class `c`, where the classes are less than 1 MiB,
+	 * less than 64 MiB, less than 1 GiB, and at least 1 GiB,
+	 * that took at least 2 to the power of `b` microseconds
+	 * but less than 2 to the power of `b + 1` microseconds;
+	 * except that the first bucket also counts shorter
+	 * times and the last bucket also counts longer times
+	 */
+	uint_least64_t latency[LIBAR2SIMPLIFIED_STATS_CLASSES][LIBAR2SIMPLIFIED_STATS_BUCKETS];
+
+	/**
+	 * The number of hashes that ran with fewer threads
+	 * than planned, because threads could not be created,
+	 * with the remaining work done by the calling thread
+	 */
+	uint_least64_t hashes_degraded;
+};
+
+/**
+ * Scheduling priority of a hash
+ */
+enum libar2simplified_priority {
+	/**
+	 * The hash is latency-sensitive, for example a login;
+	 * its work is dispatched as soon as libar2 requests it
+	 */
+	LIBAR2SIMPLIFIED_INTERACTIVE = 0,
+
+	/**
+	 * The hash is a bulk job, for example rehashing during
+	 * a migration; its work is only dispatched when fewer
+	 * segments than there are online processors are running,
+	 * in the process, so that interactive hashes go first,
+	 * and at most the share of the processors given by the
+	 * environment variable LIBAR2SIMPLIFIED_BACKGROUND_SHARE,
+	 * in percent, runs background work at the same time
+	 */
+	LIBAR2SIMPLIFIED_BACKGROUND = 1
+};
+
+/**
+ * Interface to an application-provided executor, which
+ * threaded work is run on instead of on the library's
+ * own threads
+ * 
+ * The functions may be called concurrently, from any
+ * thread, including threads of the executor itself
+ */
+struct libar2simplified_executor {
+	/**
+	 * Get the number of tasks the executor can run
+	 * in parallel; a hash is not split into more
+	 * concurrent tasks than this
+	 * 
+	 * @param   user_data  `.user_data`
+	 * @return             The number of tasks that can run in parallel
+	 */
+	size_t (*parallelism)(void *user_data);
+
+	/**
+	 * Schedule a task for execution
+	 * 
+	 * The task may be run before the function returns,
+	 * but may not be run unless it returns successfully
+	 * 
+	 * If the function fails, the hash fails, once the
+	 * tasks already submitted for it have completed
+	 * 
+	 * @param   group      Identifies the hash the task belongs to,
+	 *                     for `.wait`
+	 * @param   task       The function to run
+	 * @param   task_data  The argument to pass to `task`
+	 * @param   user_data  `.user_data`
+	 * @return             0 on success, -1 on failure
+	 * 
+	 * @throws  Any error  The task could not be scheduled, `errno`
+	 *                     shall be set to describe the error
+	 */
+	int (*submit)(void *group, void (*task)(void *task_data), void *task_data, void *user_data);
+
+	/**
+	 * Wait until at least `n` of the tasks submitted with
+	 * `group` have completed since the last time the function
+	 * returned for `group`; the executor may run other tasks
+	 * in the calling thread while waiting. A task is complete
+	 * once `task` has returned
+	 * 
+	 * `n` will not exceed the number of tasks submitted with
+	 * `group` that had not completed when the function last
+	 * returned for `group`
+	 * 
+	 * @param   group      The `group` argument given to `.submit`
+	 * @param   n          The number of completions to wait for
+	 * @param   user_data  `.user_data`
+	 * @return             0 on success, -1 on failure
+	 * 
+	 * @throws  Any error  The tasks could not be waited for,
+	 *                     `errno` shall be set to describe the error
+	 */
+	int (*wait)(void *group, size_t n, void *user_data);
+
+	/**
+	 * Passed as the last argument to the functions
+	 */
+	void *user_data;
+};
+
+/**
+ * Options for `libar2simplified_hash_opt` and
+ * `libar2simplified_init_context_opt`
+ * 
+ * Fields that are zero select the default behaviour,
+ * so the application should zero-initialise the
+ * structure and only set the fields it cares about
+ */
+struct libar2simplified_options {
+	/**
+	 * Unless zero, memory matrices are handed over to a
+	 * low-priority background thread, which erases and
+	 * deallocates them, so that the function can return
+	 * without waiting for the memory to be erased. The
+	 * memory is still erased before it is deallocated.
+	 * Small allocations, and allocations made while too
+	 * much memory is already waiting to be erased, are
+	 * erased immediately.
+	 */
+	unsigned char async_erase;
+
+	/**
+	 * Unless zero, the maximum number of threads to use
+	 * for a hash; 1 forces single-threaded execution.
+	 * If zero, the limit is taken from the environment
+	 * variable LIBAR2SIMPLIFIED_THREADS, and if that is
+	 * unset, only the number of lanes and the number of
+	 * online processors limit the number of threads
+	 */
+	size_t max_threads;
+
+	/**
+	 * Unless zero, the number of threads is not limited
+	 * to the number of online processors. Otherwise, the
+	 * number of threads is also adapted to the load: a
+	 * hash is not split over more threads than there are
+	 * processors not busy with other hashes, and hashes
+	 * with small lanes are not split over threads at all
+	 */
+	unsigned char oversubscribe;
+
+	/**
+	 * Unless `NULL`, the hash is aborted, with the
+	 * error ECANCELED, if `*cancel` becomes non-zero;
+	 * this is checked each time work is dispatched
+	 */
+	volatile sig_atomic_t *cancel;
+
+	/**
+	 * Unless zero, the hash is aborted, with the error
+	 * ETIMEDOUT, if it is not completed by this time,
+	 * measured with the CLOCK_MONOTONIC clock; this is
+	 * checked each time work is dispatched
+	 */
+	struct timespec deadline;
+
+	/**
+	 * The scheduling priority of the hash; ignored
+	 * if `.executor` is set, and for stepwise hashes,
+	 * where the executor or the caller schedules
+	 * the work
+	 */
+	enum libar2simplified_priority priority;
+
+	/**
+	 * Unless zero, the stack size, in bytes, of threads
+	 * created for the hash; idle threads created for
+	 * other hashes may be used regardless of their
+	 * stack size
+	 */
+	size_t stack_size;
+
+	/**
+	 * Unless zero, the number of milliseconds threads
+	 * used for the hash remain idle, available for
+	 * other hashes, before they exit. If zero, the
+	 * value is taken from the environment variable
+	 * LIBAR2SIMPLIFIED_IDLE_TIMEOUT, and if that is
+	 * unset, threads exit as soon as the hash is done
+	 */
+	unsigned long int idle_timeout;
+
+	/**
+	 * Unless `NULL`, the memory matrix is stored in an
+	 * unnamed file, in this directory, that is mapped into
+	 * memory, rather than in anonymous memory, so that
+	 * memory costs beyond the available memory can be used;
+	 * preferably the directory is on fast local storage.
+	 * The file is erased before it is released. If there
+	 * is not enough space in the file system, the hash
+	 * fails with ENOSPC; the file is not created
+	 * for small matrices
+	 */
+	const char *matrix_directory;
+
+	/**
+	 * Unless `NULL`, threaded work is run as tasks on
+	 * this executor rather than on threads created by
+	 * the library. The number of tasks for a hash is
+	 * still limited by `.max_threads` and the lane size,
+	 * but not by the number of online processors, but
+	 * instead by the executor's parallelism. With an
+	 * executor, the library creates no threads of its
+	 * own, so `.async_erase`, `.stack_size`, and
+	 * `.idle_timeout` are ignored; and as the work is
+	 * scheduled by the executor, so is `.priority`
+	 */
+	const struct libar2simplified_executor *executor;
+};
 
 /**
  * Get a recommended set of hashing parameter
@@ -22,6 +302,64 @@ __attribute__((const))
 #endif
 const char *libar2simplified_recommendation(int side_channel_free);
 
+/* These are useful when the hashing parameters are fixed in
+ * the application, so that they need not be parsed at runtime: */
+
+#define LIBAR2SIMPLIFIED_TYPE__d LIBAR2_ARGON2D
+#define LIBAR2SIMPLIFIED_TYPE__i LIBAR2_ARGON2I
+#define LIBAR2SIMPLIFIED_TYPE__id LIBAR2_ARGON2ID
+#define LIBAR2SIMPLIFIED_TYPE__ds LIBAR2_ARGON2DS
+#define LIBAR2SIMPLIFIED_CHECK__(COND) (0 * sizeof(char [(COND) ? 1 : -1]))
+
+/**
+ * Initialiser for a `struct libar2_argon2_parameters`,
+ * validated at compile time, where invalid values fail
+ * the build
+ * 
+ * The salt and the key (pepper) and associated data
+ * are unset; the application shall set `.salt` to
+ * a random salt of `SALTLEN` bytes before hashing
+ * 
+ * @param  TYPE     The hash function: `d`, `i`, `id`, or `ds`
+ * @param  VERSION  The version of the algorithm: 16 or 19
+ * @param  M_COST   The memory cost, in kilobytes
+ * @param  T_COST   The time cost (number of passes)
+ * @param  LANES    The number of lanes
+ * @param  SALTLEN  The salt length, in bytes
+ * @param  HASHLEN  The tag (hash) length, in bytes
+ */
+#define LIBAR2SIMPLIFIED_PARAMS_INIT(TYPE, VERSION, M_COST, T_COST, LANES, SALTLEN, HASHLEN)\
+	{\
+		.type = LIBAR2SIMPLIFIED_TYPE__##TYPE,\
+		.version = (enum libar2_argon2_version)((VERSION) +\
+		           LIBAR2SIMPLIFIED_CHECK__((VERSION) == 16 || (VERSION) == 19)),\
+		.t_cost = (uint_least32_t)((T_COST) +\
+		          LIBAR2SIMPLIFIED_CHECK__((T_COST) >= 1 && (T_COST) <= 0xFFFFFFFFUL)),\
+		.m_cost = (uint_least32_t)((M_COST) +\
+		          LIBAR2SIMPLIFIED_CHECK__((M_COST) >= 8 * (LANES) && (M_COST) <= 0xFFFFFFFFUL)),\
+		.lanes = (uint_least32_t)((LANES) +\
+		         LIBAR2SIMPLIFIED_CHECK__((LANES) >= 1 && (LANES) <= 0xFFFFFFUL)),\
+		.salt = NULL,\
+		.saltlen = (size_t)(SALTLEN) +\
+		           LIBAR2SIMPLIFIED_CHECK__((SALTLEN) >= 8 && (SALTLEN) <= 0xFFFFFFFFUL),\
+		.key = NULL,\
+		.keylen = 0,\
+		.ad = NULL,\
+		.adlen = 0,\
+		.hashlen = (size_t)(HASHLEN) +\
+		           LIBAR2SIMPLIFIED_CHECK__((HASHLEN) >= 4 && (HASHLEN) <= 0xFFFFFFFFUL)\
+	}
+
+/**
+ * The parameter string, without salt and tag, in
+ * the extended format (see `libar2simplified_encode`),
+ * as a string literal, for the same arguments as
+ * `LIBAR2SIMPLIFIED_PARAMS_INIT`; the arguments must
+ * be plain decimal integer literals
+ */
+#define LIBAR2SIMPLIFIED_PARAMS_STRING(TYPE, VERSION, M_COST, T_COST, LANES, SALTLEN, HASHLEN)\
+	"$argon2" #TYPE "$v=" #VERSION "$m=" #M_COST ",t=" #T_COST ",p=" #LANES "$*" #SALTLEN "$*" #HASHLEN
+
 /* These are useful when the database stores parameters and
  * hash separately, when the application uses a pepper, or
  * when composing multiple hash functions: */
@@ -150,6 +488,74 @@ struct libar2_argon2_parameters *
 libar2simplified_decode_r(const char *str, char **tagp, char **endp,
                           int (*random_byte_generator)(char *out, size_t n, void *user_data), void *user_data);
 
+/**
+ * The size of the fixed-size header of records
+ * created by `libar2simplified_pack`
+ */
+#define LIBAR2SIMPLIFIED_PACK_HEADER_SIZE 24
+
+/**
+ * The record format version written by
+ * `libar2simplified_pack`
+ */
+#define LIBAR2SIMPLIFIED_PACK_VERSION 1
+
+/**
+ * Encode hashing parameters, with or without hashing
+ * result, as a compact binary record
+ * 
+ * The record is a `LIBAR2SIMPLIFIED_PACK_HEADER_SIZE`
+ * bytes large header, followed by the raw salt (unless
+ * `params->salt` is `NULL`) and the raw tag (unless
+ * `hash` is `NULL`). The header contains, in order:
+ * the record format version (1 byte), the type (1 byte),
+ * the version of the algorithm (1 byte), flags (1 byte:
+ * 1 if the salt is included and 2 if the tag is included),
+ * and the memory cost, time cost, number of lanes, salt
+ * length, and tag length (each as a 4-byte, little-endian
+ * integer)
+ * 
+ * `libar2simplified_unpack` and `libar2simplified_encode`
+ * can be used to recreate the string `libar2simplified_encode`
+ * would return for the same arguments
+ * 
+ * `params->key` and `params->ad` will not be included
+ * in the record
+ * 
+ * @param   buf     Output buffer, or `NULL` to only get the size of the record
+ * @param   params  The hashing parameters, if `params->salt`
+ *                  is `NULL` only the salt's length is encoded
+ * @param   hash    The tag, or `NULL` to only encode the tag's length
+ * @return          The size of the record, or 0 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(2)
+size_t libar2simplified_pack(void *buf, const struct libar2_argon2_parameters *params, const void *hash);
+
+/**
+ * Decode a record created by `libar2simplified_pack`
+ * 
+ * Unlike `libar2simplified_decode`, a salt is not
+ * generated if the record does not include one;
+ * `params->salt` is set to `NULL` instead; where
+ * `params` is the returned pointer
+ * 
+ * @param   buf    The record
+ * @param   len    The number of bytes available in `buf`,
+ *                 which may exceed the size of the record
+ * @param   hashp  Output parameter for the tag (hash result), or `NULL`.
+ *                 Unless `NULL`, the beginning of the raw tag, in `buf`,
+ *                 or `NULL` if the record does not include the tag, will
+ *                 be stored in `*hashp`
+ * @param   endp   Output parameter for the size of the record, or `NULL`
+ * @return         Decoded hashing parameters, or `NULL` on failure. Shall
+ *                 be deallocated using free(3) when no longer needed.
+ *                 Be aware than the allocation size of the returned object
+ *                 will exceed the size of the return type.
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+struct libar2_argon2_parameters *
+libar2simplified_unpack(const void *buf, size_t len, const void **hashp, size_t *endp);
+
 /**
  * Calculate a password hash
  * 
@@ -166,6 +572,213 @@ libar2simplified_decode_r(const char *str, char **tagp, char **endp,
 LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 4)
 int libar2simplified_hash(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params);
 
+/**
+ * Calculate a password hash
+ * 
+ * This function works like `libar2simplified_hash`,
+ * except it lets the application select options
+ * 
+ * @param   hash    Output parameter for the tag (hash result).
+ *                  This must be a buffer than is at least
+ *                  `libar2_hash_buf_size(params)` bytes large.
+ * @param   msg     The message (password) to hash. Will be
+ *                  erased (not deallocated) some time before
+ *                  the function returns.
+ * @param   msglen  The number of bytes in `msg`
+ * @param   params  Hashing parameters
+ * @param   opts    Options, `NULL` for the default options
+ * @return          0 on success, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 4)
+int libar2simplified_hash_opt(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                              const struct libar2simplified_options *opts);
+
+/**
+ * A password to hash with `libar2simplified_hash_batch`
+ */
+struct libar2simplified_batch_entry {
+	/**
+	 * Output parameter for the tag (hash result).
+	 * This must be a buffer than is at least
+	 * `libar2_hash_buf_size(params)` bytes large.
+	 */
+	void *hash;
+
+	/**
+	 * The message (password) to hash. Will be
+	 * erased (not deallocated) some time before
+	 * `libar2simplified_hash_batch` returns.
+	 */
+	void *msg;
+
+	/**
+	 * The number of bytes in `msg`
+	 */
+	size_t msglen;
+
+	/**
+	 * Hashing parameters
+	 */
+	struct libar2_argon2_parameters *params;
+
+	/**
+	 * Output parameter set to 0 if the password was
+	 * hashed, and to an `errno` value otherwise
+	 */
+	int error;
+};
+
+/**
+ * Calculate multiple independent password hashes
+ * 
+ * The hashes are calculated concurrently, each on its
+ * own thread, rather than one after another with each
+ * split over threads, which is how to get the most
+ * hashes per second when there are many hashes with
+ * few lanes (typically `p=1`) to calculate. The number
+ * of concurrent hashes is limited like the number of
+ * threads for one hash is by `libar2simplified_hash_opt`
+ * 
+ * @param   entries  The passwords to hash
+ * @param   n        The number of elements in `entries`
+ * @param   opts     Options, `NULL` for the default options;
+ *                   cancellation is checked before each hash
+ *                   is started
+ * @return           0 if all passwords were hashed, -1 otherwise,
+ *                   in which case `errno` is set to the `.error`
+ *                   of the first entry that failed, or if the
+ *                   thread pool could not be torn down, to the
+ *                   error from that, in which case entries that
+ *                   were hashed have 0 in `.error`
+ */
+LIBAR2_PUBLIC__
+int libar2simplified_hash_batch(struct libar2simplified_batch_entry *entries, size_t n,
+                                const struct libar2simplified_options *opts);
+
+/**
+ * A password hash calculated step by step, see
+ * `libar2simplified_hash_start`
+ */
+struct libar2simplified_hash_state;
+
+/**
+ * Prepare to calculate a password hash step by step,
+ * for applications, such as event loops, that cannot
+ * use threads or block for the whole calculation
+ * 
+ * No calculation is done by this function; the hash is
+ * calculated by `libar2simplified_hash_step`, in the
+ * calling thread, on a stack of its own, without the
+ * use of any other threads
+ * 
+ * @param   hash    Output parameter for the hash, see `libar2simplified_hash_opt`;
+ *                  must remain valid until the calculation is complete
+ * @param   msg     The message (password) to hash. Will be erased (not
+ *                  deallocated) some time before the calculation is complete,
+ *                  has failed, or is aborted, and must remain valid until then
+ * @param   msglen  The number of bytes in `msg`
+ * @param   params  Hashing parameters, must remain valid until the
+ *                  calculation is complete
+ * @param   opts    Options, `NULL` for the default options; options
+ *                  that concern threads, and `.priority`, are ignored,
+ *                  but `.cancel` and `.deadline` are checked between
+ *                  the segments
+ * @return          State to pass to `libar2simplified_hash_step`
+ *                  or `libar2simplified_hash_abort`, `NULL` on failure;
+ *                  fails with `ENOSYS` on systems without ucontext
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 4)
+struct libar2simplified_hash_state *libar2simplified_hash_start(void *hash, void *msg, size_t msglen,
+                                                                struct libar2_argon2_parameters *params,
+                                                                const struct libar2simplified_options *opts);
+
+/**
+ * Advance a calculation started with `libar2simplified_hash_start`
+ * 
+ * The memory is allocated in the first step, and
+ * each step processes at most `budget` segments (one
+ * lane's share of a quarter of a pass over the memory,
+ * which is `m_cost / lanes / 4` memory blocks) before
+ * it returns, except that the last step also finishes
+ * the calculation
+ * 
+ * The function never waits: if LIBAR2SIMPLIFIED_PRESSURE
+ * throttles the allocation of the memory, the step returns
+ * 0 without progress, and the next step tries again
+ * 
+ * @param   state   The state of the calculation, which is
+ *                  deallocated when the function returns
+ *                  a value other than 0
+ * @param   budget  The maximum number of segments to
+ *                  process, must be positive
+ * @return          1 if the hash is complete, 0 if more steps
+ *                  are required, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+int libar2simplified_hash_step(struct libar2simplified_hash_state *state, size_t budget);
+
+/**
+ * Abandon a calculation started with `libar2simplified_hash_start`,
+ * erasing and deallocating everything it has allocated, and
+ * erasing the message
+ * 
+ * @param  state  The state of the calculation
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+void libar2simplified_hash_abort(struct libar2simplified_hash_state *state);
+
+/**
+ * A key to derive with `libar2simplified_derive_keys`
+ */
+struct libar2simplified_subkey {
+	/**
+	 * The purpose of the key, for example "encryption",
+	 * "mac", or "index"; must be unique among the keys
+	 * derived together. Keys with different labels are
+	 * independent of each other.
+	 */
+	const char *label;
+
+	/**
+	 * Output parameter for the key
+	 */
+	void *key;
+
+	/**
+	 * The number of bytes to store in `key`,
+	 * between 1 and 64, inclusively
+	 */
+	size_t keylen;
+};
+
+/**
+ * Derive multiple keys from one password, calculating
+ * the Argon2 hash only once
+ * 
+ * The hash is calculated as with `libar2simplified_hash_opt`,
+ * and each key is then derived from it with keyed BLAKE2b,
+ * with the key's label as the message, so recovering the
+ * password from any key, or one key from another, is as
+ * hard as for the hash itself
+ * 
+ * @param   subkeys  The keys to derive
+ * @param   n        The number of elements in `subkeys`
+ * @param   msg      The message (password) to hash. Will be
+ *                   erased (not deallocated) some time before
+ *                   the function returns
+ * @param   msglen   The number of bytes in `msg`
+ * @param   params   Hashing parameters; `params->hashlen`, the
+ *                   number of bytes of hash to derive the keys
+ *                   from, must be between 32 and 64, inclusively,
+ *                   as a shorter hash would weaken every key
+ * @param   opts     Options, `NULL` for the default options
+ * @return           0 on success, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(5)
+int libar2simplified_derive_keys(struct libar2simplified_subkey *subkeys, size_t n, void *msg, size_t msglen,
+                                 struct libar2_argon2_parameters *params,
+                                 const struct libar2simplified_options *opts);
+
 /* This one is useful you just want to do it crypt(3)-style: */
 
 /**
@@ -208,6 +821,220 @@ int libar2simplified_hash(void *hash, void *msg, size_t msglen, struct libar2_ar
 LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 2)
 char *libar2simplified_crypt(char *msg, const char *params, char *rv);
 
+/**
+ * Cache of recent verification results, see
+ * `libar2simplified_verify_cache_create`
+ */
+struct libar2simplified_verify_cache;
+
+/**
+ * Create a cache of recent verification results
+ * for `libar2simplified_verify`
+ * 
+ * The cache is keyed by a BLAKE2b MAC, under a random
+ * key generated for the cache, of the hash string and
+ * the password; only the MAC and the verdict are stored.
+ * Evicted and expired entries are erased
+ * 
+ * The cache may be used concurrently by multiple threads
+ * 
+ * @param   capacity  The maximum number of entries, must be positive
+ * @param   ttl_msec  The number of milliseconds an entry is valid
+ * @return            The cache, `NULL` on failure; shall be
+ *                    deallocated with `libar2simplified_verify_cache_destroy`
+ */
+LIBAR2_PUBLIC__
+struct libar2simplified_verify_cache *libar2simplified_verify_cache_create(size_t capacity, unsigned long int ttl_msec);
+
+/**
+ * Erase and deallocate a cache created with
+ * `libar2simplified_verify_cache_create`
+ * 
+ * @param  cache  The cache, may be `NULL`
+ */
+LIBAR2_PUBLIC__
+void libar2simplified_verify_cache_destroy(struct libar2simplified_verify_cache *cache);
+
+/**
+ * Check a password against a hash string
+ * 
+ * The password is hashed with the parameters and salt
+ * in the hash string, and the result is compared, in
+ * constant time, against the tag (hash) in the hash
+ * string; unless the verdict is available in `cache`
+ * 
+ * If the same password is already being checked against
+ * the same hash string, by another thread, the function
+ * waits for and returns that result instead of hashing
+ * the password again; the requests are matched by a
+ * BLAKE2b MAC, under a random key generated for the
+ * process, which is erased when the check is complete
+ * 
+ * @param   msg      The password to check. NB! Will be erased (not
+ *                   deallocated) some time before the function returns.
+ * @param   hashstr  Hashing parameter string with salt and tag, as
+ *                   returned by `libar2simplified_crypt`, without
+ *                   any excess data
+ * @param   cache    Cache of recent results, `NULL` to not use a cache
+ * @return           1 if the password matches, 0 if it does not,
+ *                   and -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 2)
+int libar2simplified_verify(char *msg, const char *hashstr, struct libar2simplified_verify_cache *cache);
+
+/* Hashing daemon client: */
+
+/**
+ * The socket `libar2simplified_remote_connect` connects
+ * to by default, unless overridden by the environment
+ * variable LIBAR2SIMPLIFIED_SOCKET
+ */
+#define LIBAR2SIMPLIFIED_DEFAULT_SOCKET "/run/ar2simplified.socket"
+
+/**
+ * The size of the fixed-size header of request frames
+ * sent by `libar2simplified_remote_hash`
+ * 
+ * The header contains, in order, the number of bytes
+ * in the frame after the header, and the lengths of
+ * the message, the key, and the associated data (each
+ * as a 4-byte, little-endian integer). It is followed
+ * by the hashing parameters, with salt, encoded as by
+ * `libar2simplified_pack`, the message, the key, and
+ * the associated data
+ */
+#define LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE 16
+
+/**
+ * The size of the fixed-size header of response frames
+ * received by `libar2simplified_remote_hash`
+ * 
+ * The header contains, in order, the number of bytes
+ * in the frame after the header, and 0 on success or
+ * an `errno` value on failure (each as a 4-byte,
+ * little-endian integer). On success it is followed
+ * by the tag (hash result)
+ */
+#define LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE 8
+
+/**
+ * Connect to a hashing daemon (`ar2simplified serve`)
+ * 
+ * @param   path  The path of the daemon's socket, `NULL` for
+ *                the value of the environment variable
+ *                LIBAR2SIMPLIFIED_SOCKET, or if unset or empty,
+ *                `LIBAR2SIMPLIFIED_DEFAULT_SOCKET`
+ * @return        A file descriptor for the connection, or -1
+ *                on failure; shall be closed with close(3) when
+ *                no longer needed
+ */
+LIBAR2_PUBLIC__
+int libar2simplified_remote_connect(const char *path);
+
+/**
+ * Calculate a password hash using a hashing daemon
+ * 
+ * This function works like `libar2simplified_hash`,
+ * except the hash is calculated by the daemon at the
+ * other end of `fd`; the request is sent as a single
+ * frame and the function waits for the response
+ * 
+ * The connection may only be used by one thread at
+ * a time, and after a failure with `errno` set to
+ * `EPROTO`, or a failure while sending or receiving,
+ * it should be closed
+ * 
+ * @param   fd      Connection returned by `libar2simplified_remote_connect`
+ * @param   hash    Output parameter for the tag (hash result).
+ *                  This must be a buffer than is at least
+ *                  `libar2_hash_buf_size(params)` bytes large.
+ * @param   msg     The message (password) to hash. Will be
+ *                  erased (not deallocated) some time before
+ *                  the function returns.
+ * @param   msglen  The number of bytes in `msg`
+ * @param   params  Hashing parameters, must include the salt
+ * @return          0 on success, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(2, 5)
+int libar2simplified_remote_hash(int fd, void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params);
+
+/* Capacity planning: */
+
+/**
+ * Predicted cost of a hash, see `libar2simplified_estimate`
+ */
+struct libar2simplified_cost {
+	/**
+	 * The elapsed time, in microseconds
+	 */
+	uint_least64_t wall_time;
+
+	/**
+	 * The processor time, summed over
+	 * all threads, in microseconds
+	 */
+	uint_least64_t cpu_time;
+
+	/**
+	 * The peak amount of allocated memory, in bytes
+	 */
+	uint_least64_t peak_memory;
+
+	/**
+	 * The number of threads the hash is split over
+	 */
+	size_t threads;
+};
+
+/**
+ * Predict how long a hash will take, and how much
+ * memory it will need, on this host, without
+ * calculating it
+ * 
+ * The prediction is made from a model fitted, the
+ * first time the function is called in the process,
+ * from a few single-threaded hashes of 64 MiB and
+ * 128 MiB, larger than the last-level cache, so the
+ * first call may allocate up to 128 MiB; or taken
+ * from the environment variable
+ * LIBAR2SIMPLIFIED_COST_MODEL, whose value is three
+ * comma-separated integers: nanoseconds per hash,
+ * nanoseconds per memory block and pass, and nanoseconds
+ * per memory block for allocating it. The memory
+ * bandwidth shared between threads is not modelled,
+ * so the wall time is optimistic for hashes split
+ * over many threads
+ * 
+ * The function is thread-safe
+ * 
+ * @param   costp    Output parameter for the prediction
+ * @param   params   Hashing parameters
+ * @param   threads  The number of threads the hash may use,
+ *                   0 for the number of online processors; as
+ *                   with `libar2simplified_hash`, fewer are used
+ *                   if there are fewer lanes, or the lanes are small
+ * @return           0 on success, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1, 2)
+int libar2simplified_estimate(struct libar2simplified_cost *costp, const struct libar2_argon2_parameters *params,
+                              size_t threads);
+
+/* Monitoring: */
+
+/**
+ * Get a copy of the process-wide counters
+ * 
+ * The counters are updated by `libar2simplified_hash_opt`
+ * (and the functions built upon it) and by contexts created
+ * with `libar2simplified_init_context` or
+ * `libar2simplified_init_context_opt`. Each counter is read
+ * atomically, but the snapshot as a whole is not atomic.
+ * 
+ * @param  statsp  Output parameter for the counters
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+void libar2simplified_stats_snapshot(struct libar2simplified_stats *statsp);
+
 /* Lower-level functions: */
 
 /**
@@ -224,4 +1051,37 @@ char *libar2simplified_crypt(char *msg, const char *params, char *rv);
 LIBAR2_PUBLIC__
 void libar2simplified_init_context(struct libar2_context *ctxp);
 
+/**
+ * Initialises the context argument for `libar2_hash`,
+ * with all auto-erase options turned off, like
+ * `libar2simplified_init_context` does, but with
+ * options applied
+ * 
+ * The context must be released with
+ * `libar2simplified_destroy_context` when it is no
+ * longer needed, and may not be used for multiple
+ * concurrent calls to `libar2_hash`
+ * 
+ * @param   ctxp  Output parameter
+ * @param   opts  Options, `NULL` for the default options;
+ *                the options are copied into the context
+ * @return        0 on success, -1 on failure
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+int libar2simplified_init_context_opt(struct libar2_context *ctxp, const struct libar2simplified_options *opts);
+
+/**
+ * Release resources allocated for a context
+ * created by `libar2simplified_init_context_opt`
+ * or `libar2simplified_init_context`
+ * 
+ * @param  ctxp  The context
+ */
+LIBAR2_PUBLIC__ LIBAR2_NONNULL__(1)
+void libar2simplified_destroy_context(struct libar2_context *ctxp);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
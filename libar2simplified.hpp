@@ -0,0 +1,644 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef LIBAR2SIMPLIFIED_HPP
+#define LIBAR2SIMPLIFIED_HPP
+
+#if __cplusplus < 201703L
+# error libar2simplified.hpp requires C++17 or newer
+#endif
+
+extern "C" {
+#include <libar2.h>
+}
+#include <libar2simplified.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+
+/* Header-only C++ interface, which requires C++17 as it
+ * uses std::string_view and inline variables: parameters,
+ * tags, and encoded strings live in fixed-capacity buffers
+ * inside the objects, so nothing here allocates memory on
+ * the heap, and every type that may hold secret data erases
+ * it when destroyed. Functions do not throw; errors are
+ * returned as a std::error_code in the generic category. */
+
+namespace libar2simplified {
+
+
+/**
+ * The maximum salt size, in bytes, `params` can hold
+ */
+inline constexpr std::size_t MAX_SALT_SIZE = 64;
+
+/**
+ * The maximum tag (hash) size, in bytes, `tag` can hold
+ */
+inline constexpr std::size_t MAX_TAG_SIZE = 128;
+
+/**
+ * The maximum length of a hashing parameter string,
+ * including the tag, that `params::decode` accepts,
+ * and the default capacity of `encoded`
+ */
+inline constexpr std::size_t MAX_ENCODED_LENGTH = 384;
+
+/**
+ * The maximum length of a password that the functions
+ * taking the password as a `std::string_view` accept
+ */
+inline constexpr std::size_t MAX_MESSAGE_LENGTH = 1024;
+
+
+namespace detail {
+	inline std::error_code
+	last_error(void) noexcept
+	{
+		return std::error_code(errno ? errno : EINVAL, std::generic_category());
+	}
+
+	inline std::error_code
+	error(int code) noexcept
+	{
+		return std::error_code(code, std::generic_category());
+	}
+
+	/* Temporary NUL-terminated copy of a string,
+	 * erased when it goes out of scope */
+	template <std::size_t N>
+	struct cstring {
+		char buf[N + 1];
+		bool ok;
+
+		explicit cstring(std::string_view s) noexcept
+			: ok(s.size() <= N)
+		{
+			if (ok) {
+				std::memcpy(buf, s.data(), s.size());
+				buf[s.size()] = '\0';
+			} else {
+				buf[0] = '\0';
+			}
+		}
+
+		~cstring() { libar2_erase(buf, sizeof(buf)); }
+
+		cstring(const cstring &) = delete;
+		cstring &operator=(const cstring &) = delete;
+	};
+}
+
+
+/**
+ * Hashing parameters without salt, as parsed at compile
+ * time by `parse_params`
+ */
+struct fixed_params {
+	libar2_argon2_type type;
+	libar2_argon2_version version;
+	std::uint_least32_t t_cost;
+	std::uint_least32_t m_cost;
+	std::uint_least32_t lanes;
+	std::size_t saltlen;
+	std::size_t hashlen;
+};
+
+
+namespace detail {
+	constexpr bool
+	skip(std::string_view &s, std::string_view prefix)
+	{
+		if (s.substr(0, prefix.size()) != prefix)
+			return false;
+		s.remove_prefix(prefix.size());
+		return true;
+	}
+
+	constexpr std::uint_least32_t
+	parse_u32(std::string_view &s)
+	{
+		std::uint_least32_t n = 0, digit = 0;
+		std::size_t i = 0;
+		if (s.empty() || s[0] < '0' || s[0] > '9' || (s[0] == '0' && s.size() > 1 && s[1] >= '0' && s[1] <= '9'))
+			throw std::invalid_argument("libar2simplified::parse_params: expected a decimal integer");
+		for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++) {
+			digit = (std::uint_least32_t)(s[i] - '0');
+			if (n > (0xFFFFFFFFUL - digit) / 10)
+				throw std::invalid_argument("libar2simplified::parse_params: integer out of range");
+			n = n * 10 + digit;
+		}
+		s.remove_prefix(i);
+		return n;
+	}
+}
+
+
+/**
+ * Parse a hashing parameter string with only the salt
+ * length and tag length specified, such as
+ * "$argon2id$v=19$m=3072,t=32,p=4$*16$*48"
+ * 
+ * When used in a constant expression, for example to
+ * initialise a `constexpr` variable, the string is parsed
+ * and validated at compile time, and an invalid string
+ * fails the build; otherwise `std::invalid_argument` is
+ * thrown for invalid strings
+ * 
+ * @param   str  The hashing parameter string
+ * @return       The hashing parameters
+ */
+constexpr fixed_params
+parse_params(std::string_view str)
+{
+	fixed_params p{};
+
+	if (detail::skip(str, "$argon2ds$"))
+		p.type = LIBAR2_ARGON2DS;
+	else if (detail::skip(str, "$argon2id$"))
+		p.type = LIBAR2_ARGON2ID;
+	else if (detail::skip(str, "$argon2d$"))
+		p.type = LIBAR2_ARGON2D;
+	else if (detail::skip(str, "$argon2i$"))
+		p.type = LIBAR2_ARGON2I;
+	else
+		throw std::invalid_argument("libar2simplified::parse_params: unsupported type");
+
+	p.version = LIBAR2_ARGON2_VERSION_10;
+	if (detail::skip(str, "v=")) {
+		switch (detail::parse_u32(str)) {
+		case 16: p.version = LIBAR2_ARGON2_VERSION_10; break;
+		case 19: p.version = LIBAR2_ARGON2_VERSION_13; break;
+		default:
+			throw std::invalid_argument("libar2simplified::parse_params: unsupported version");
+		}
+		if (!detail::skip(str, "$"))
+			throw std::invalid_argument("libar2simplified::parse_params: expected '$'");
+	}
+
+	if (!detail::skip(str, "m="))
+		throw std::invalid_argument("libar2simplified::parse_params: expected 'm='");
+	p.m_cost = detail::parse_u32(str);
+	if (!detail::skip(str, ",t="))
+		throw std::invalid_argument("libar2simplified::parse_params: expected ',t='");
+	p.t_cost = detail::parse_u32(str);
+	if (!detail::skip(str, ",p="))
+		throw std::invalid_argument("libar2simplified::parse_params: expected ',p='");
+	p.lanes = detail::parse_u32(str);
+	if (!detail::skip(str, "$*"))
+		throw std::invalid_argument("libar2simplified::parse_params: expected '$*' and salt length");
+	p.saltlen = detail::parse_u32(str);
+	if (!detail::skip(str, "$*"))
+		throw std::invalid_argument("libar2simplified::parse_params: expected '$*' and tag length");
+	p.hashlen = detail::parse_u32(str);
+	if (!str.empty())
+		throw std::invalid_argument("libar2simplified::parse_params: excess data");
+
+	if (p.t_cost < 1)
+		throw std::invalid_argument("libar2simplified::parse_params: time cost too small");
+	if (p.lanes < 1 || p.lanes > 0xFFFFFFUL)
+		throw std::invalid_argument("libar2simplified::parse_params: lane count out of range");
+	if (p.m_cost < 8 * (std::uint_least64_t)p.lanes)
+		throw std::invalid_argument("libar2simplified::parse_params: memory cost too small");
+	if (p.saltlen < 8 || p.saltlen > MAX_SALT_SIZE)
+		throw std::invalid_argument("libar2simplified::parse_params: salt length out of range");
+	if (p.hashlen < 4 || p.hashlen > MAX_TAG_SIZE)
+		throw std::invalid_argument("libar2simplified::parse_params: tag length out of range");
+
+	return p;
+}
+
+
+/**
+ * Hashing parameters, with inline storage for the salt
+ */
+class params {
+	libar2_argon2_parameters p_{};
+	unsigned char salt_[MAX_SALT_SIZE];
+
+	static void *
+	allocate(std::size_t num, std::size_t size, std::size_t, libar2_context *ctx) noexcept
+	{
+		params *self = static_cast<params *>(ctx->user_data);
+		if (num > MAX_SALT_SIZE || size > MAX_SALT_SIZE / (num ? num : 1)) {
+			errno = ENOMEM;
+			return nullptr;
+		}
+		return self->salt_;
+	}
+
+	static void
+	deallocate(void *, libar2_context *) noexcept
+	{
+	}
+
+	void
+	take(params &other) noexcept
+	{
+		p_ = other.p_;
+		std::memcpy(salt_, other.salt_, sizeof(salt_));
+		if (p_.salt)
+			p_.salt = salt_;
+		other.clear();
+	}
+
+public:
+	params() noexcept { std::memset(salt_, 0, sizeof(salt_)); }
+	~params() { clear(); }
+
+	params(params &&other) noexcept { take(other); }
+	params &operator=(params &&other) noexcept { if (this != &other) { clear(); take(other); } return *this; }
+	params(const params &) = delete;
+	params &operator=(const params &) = delete;
+
+	/**
+	 * Erase the parameters
+	 */
+	void
+	clear(void) noexcept
+	{
+		libar2_erase(salt_, sizeof(salt_));
+		libar2_erase(&p_, sizeof(p_));
+	}
+
+	/**
+	 * Decode a hashing parameter string, with or without
+	 * a tag; like `libar2simplified_decode`, except that
+	 * the salt must be specified exactly
+	 * 
+	 * @param   str   The hashing parameter string, without excess data
+	 * @param   tagp  Unless `nullptr`, set to the tag in `str`, or
+	 *                to an empty string if `str` has no exact tag
+	 * @return        Error code, empty on success
+	 */
+	std::error_code
+	decode(std::string_view str, std::string_view *tagp = nullptr) noexcept
+	{
+		detail::cstring<MAX_ENCODED_LENGTH> s(str);
+		libar2_context ctx{};
+		const char *tag;
+		char *buf = nullptr;
+		std::size_t n, hashlen = 0;
+
+		clear();
+		if (!s.ok)
+			return detail::error(ENAMETOOLONG);
+		ctx.user_data = this;
+		ctx.allocate = allocate;
+		ctx.deallocate = deallocate;
+
+		errno = 0;
+		n = libar2_decode_params(s.buf, &p_, &buf, &ctx);
+		if (!n)
+			return clear(), detail::last_error();
+		tag = &s.buf[n];
+		if (*tag == '*') {
+			for (tag++; *tag >= '0' && *tag <= '9'; tag++) {
+				if (hashlen > (MAX_TAG_SIZE - (std::size_t)(*tag & 15)) / 10)
+					return clear(), detail::error(EINVAL);
+				hashlen = hashlen * 10 + (std::size_t)(*tag & 15);
+			}
+			if (*tag || tag == &s.buf[n + 1])
+				return clear(), detail::error(EINVAL);
+			p_.hashlen = hashlen;
+			if (tagp)
+				*tagp = std::string_view();
+		} else {
+			n += libar2_encode_base64(nullptr, nullptr, p_.hashlen) - 1;
+			if (n != str.size())
+				return clear(), detail::error(EINVAL);
+			if (tagp)
+				*tagp = str.substr((std::size_t)(tag - s.buf));
+		}
+		if (p_.hashlen > MAX_TAG_SIZE)
+			return clear(), detail::error(EINVAL);
+		return {};
+	}
+
+	/**
+	 * Set the parameters from parameters parsed at compile time
+	 * 
+	 * @param  fixed  The parameters
+	 * @param  salt   The salt, `fixed.saltlen` bytes long
+	 */
+	void
+	assign(const fixed_params &fixed, const void *salt) noexcept
+	{
+		clear();
+		p_.type = fixed.type;
+		p_.version = fixed.version;
+		p_.t_cost = fixed.t_cost;
+		p_.m_cost = fixed.m_cost;
+		p_.lanes = fixed.lanes;
+		p_.saltlen = fixed.saltlen;
+		p_.hashlen = fixed.hashlen;
+		std::memcpy(salt_, salt, fixed.saltlen);
+		p_.salt = salt_;
+	}
+
+	/**
+	 * Set the parameters from parameters parsed at compile
+	 * time, with a salt generated with `std::random_device`
+	 * 
+	 * @param   fixed  The parameters
+	 * @return         Error code, empty on success
+	 */
+	std::error_code
+	assign(const fixed_params &fixed) noexcept
+	{
+		unsigned char salt[MAX_SALT_SIZE];
+		unsigned int r;
+		std::size_t i;
+
+		try {
+			std::random_device rng;
+			for (i = 0; i < fixed.saltlen; i += sizeof(r)) {
+				r = rng();
+				std::memcpy(&salt[i], &r, fixed.saltlen - i < sizeof(r) ? fixed.saltlen - i : sizeof(r));
+			}
+		} catch (...) {
+			return detail::error(EAGAIN);
+		}
+		assign(fixed, salt);
+		libar2_erase(salt, sizeof(salt));
+		return {};
+	}
+
+	/**
+	 * @return  The parameters, for use with libar2; if the
+	 *          salt is replaced, it must outlive this object
+	 */
+	libar2_argon2_parameters &get(void) noexcept { return p_; }
+	const libar2_argon2_parameters &get(void) const noexcept { return p_; }
+};
+
+
+/**
+ * A hashing result (tag)
+ */
+class tag {
+	unsigned char data_[MAX_TAG_SIZE];
+	std::size_t size_ = 0;
+
+public:
+	tag() noexcept { std::memset(data_, 0, sizeof(data_)); }
+	~tag() { clear(); }
+
+	tag(tag &&other) noexcept : size_(other.size_) { std::memcpy(data_, other.data_, sizeof(data_)); other.clear(); }
+	tag &operator=(tag &&other) noexcept
+	{
+		if (this != &other) {
+			std::memcpy(data_, other.data_, sizeof(data_));
+			size_ = other.size_;
+			other.clear();
+		}
+		return *this;
+	}
+	tag(const tag &) = delete;
+	tag &operator=(const tag &) = delete;
+
+	/**
+	 * Erase the tag
+	 */
+	void clear(void) noexcept { libar2_erase(data_, sizeof(data_)); size_ = 0; }
+
+	unsigned char *data(void) noexcept { return data_; }
+	const unsigned char *data(void) const noexcept { return data_; }
+	std::size_t size(void) const noexcept { return size_; }
+
+	/**
+	 * Calculate a password hash, see `libar2simplified_hash_opt`
+	 * 
+	 * @param   msg      The password; NB! will be erased
+	 * @param   msglen   The length of `msg`
+	 * @param   params   Hashing parameters
+	 * @param   opts     Options, `nullptr` for the default options
+	 * @return           Error code, empty on success
+	 */
+	std::error_code
+	hash(void *msg, std::size_t msglen, params &params, const libar2simplified_options *opts = nullptr) noexcept
+	{
+		std::size_t size = libar2_hash_buf_size(&params.get());
+
+		clear();
+		if (!size || size > sizeof(data_)) {
+			libar2_erase(msg, msglen);
+			return detail::error(EINVAL);
+		}
+		if (libar2simplified_hash_opt(data_, msg, msglen, &params.get(), opts))
+			return clear(), detail::last_error();
+		size_ = params.get().hashlen;
+		return {};
+	}
+
+	/**
+	 * Calculate a password hash, see `libar2simplified_hash_opt`
+	 * 
+	 * @param   msg      The password, which is copied
+	 * @param   params   Hashing parameters
+	 * @param   opts     Options, `nullptr` for the default options
+	 * @return           Error code, empty on success
+	 */
+	std::error_code
+	hash(std::string_view msg, params &params, const libar2simplified_options *opts = nullptr) noexcept
+	{
+		detail::cstring<MAX_MESSAGE_LENGTH> m(msg);
+		if (!m.ok)
+			return detail::error(E2BIG);
+		return hash(m.buf, msg.size(), params, opts);
+	}
+};
+
+
+/**
+ * A hashing parameter string, with or without
+ * tag, in a fixed-capacity buffer
+ * 
+ * @param  N  The capacity, excluding the NUL byte
+ */
+template <std::size_t N = MAX_ENCODED_LENGTH>
+class encoded {
+	char buf_[N + 1];
+	std::size_t len_ = 0;
+
+public:
+	encoded() noexcept { buf_[0] = '\0'; }
+	~encoded() { clear(); }
+
+	encoded(encoded &&other) noexcept : len_(other.len_) { std::memcpy(buf_, other.buf_, sizeof(buf_)); other.clear(); }
+	encoded &operator=(encoded &&other) noexcept
+	{
+		if (this != &other) {
+			std::memcpy(buf_, other.buf_, sizeof(buf_));
+			len_ = other.len_;
+			other.clear();
+		}
+		return *this;
+	}
+	encoded(const encoded &) = delete;
+	encoded &operator=(const encoded &) = delete;
+
+	/**
+	 * Erase the string
+	 */
+	void clear(void) noexcept { libar2_erase(buf_, sizeof(buf_)); len_ = 0; }
+
+	const char *c_str(void) const noexcept { return buf_; }
+	std::string_view view(void) const noexcept { return std::string_view(buf_, len_); }
+	std::size_t size(void) const noexcept { return len_; }
+
+	/**
+	 * Encode hashing parameters and a tag, see
+	 * `libar2simplified_encode`; the salt must
+	 * be specified exactly
+	 * 
+	 * @param   params  The hashing parameters
+	 * @param   hash    The tag, `nullptr` to encode the tag length only
+	 * @return          Error code, empty on success
+	 */
+	std::error_code
+	encode(const params &params, const tag *hash = nullptr) noexcept
+	{
+		const libar2_argon2_parameters &p = params.get();
+		std::size_t n;
+		int r;
+
+		clear();
+		if (!p.salt || libar2_validate_params(&p, nullptr) != LIBAR2_OK)
+			return detail::error(EINVAL);
+		if (hash && hash->size() != p.hashlen)
+			return detail::error(EINVAL);
+		n = libar2_encode_params(nullptr, &p) - 1;
+		if (n > N)
+			return detail::error(ENAMETOOLONG);
+		libar2_encode_params(buf_, &p);
+		if (hash) {
+			if (libar2_encode_base64(nullptr, nullptr, p.hashlen) - 1 > N - n)
+				return clear(), detail::error(ENAMETOOLONG);
+			n += libar2_encode_base64(&buf_[n], hash->data(), p.hashlen) - 1;
+		} else {
+			r = std::snprintf(&buf_[n], N + 1 - n, "*%zu", p.hashlen);
+			if (r < 0 || (std::size_t)r > N - n)
+				return clear(), detail::error(ENAMETOOLONG);
+			n += (std::size_t)r;
+		}
+		len_ = n;
+		return {};
+	}
+};
+
+
+/**
+ * A context for `libar2_hash`, see
+ * `libar2simplified_init_context_opt`
+ */
+class context {
+	libar2_context ctx_;
+
+public:
+	context() noexcept { libar2simplified_init_context(&ctx_); }
+	~context() { libar2simplified_destroy_context(&ctx_); }
+
+	context(context &&other) noexcept : ctx_(other.ctx_) { libar2simplified_init_context(&other.ctx_); }
+	context &operator=(context &&other) noexcept
+	{
+		if (this != &other) {
+			libar2simplified_destroy_context(&ctx_);
+			ctx_ = other.ctx_;
+			libar2simplified_init_context(&other.ctx_);
+		}
+		return *this;
+	}
+	context(const context &) = delete;
+	context &operator=(const context &) = delete;
+
+	/**
+	 * Reinitialise the context with options
+	 * 
+	 * @param   opts  Options, `nullptr` for the default options
+	 * @return        Error code, empty on success
+	 */
+	std::error_code
+	init(const libar2simplified_options *opts) noexcept
+	{
+		libar2simplified_destroy_context(&ctx_);
+		if (libar2simplified_init_context_opt(&ctx_, opts)) {
+			std::error_code ec = detail::last_error();
+			libar2simplified_init_context(&ctx_);
+			return ec;
+		}
+		return {};
+	}
+
+	libar2_context &get(void) noexcept { return ctx_; }
+};
+
+
+/**
+ * Check a password against a hash string,
+ * see `libar2simplified_verify`
+ * 
+ * @param   msg      The password, which is copied
+ * @param   hashstr  The hash string
+ * @param   cache    Cache of recent results, `nullptr` to not use a cache
+ * @param   ec       Set to the error code on failure, and cleared on success
+ * @return           Whether the password matches
+ */
+inline bool
+verify(std::string_view msg, std::string_view hashstr, std::error_code &ec,
+       libar2simplified_verify_cache *cache = nullptr) noexcept
+{
+	detail::cstring<MAX_MESSAGE_LENGTH> m(msg);
+	detail::cstring<MAX_ENCODED_LENGTH> h(hashstr);
+	int r;
+
+	ec.clear();
+	if (!m.ok || !h.ok) {
+		ec = detail::error(!m.ok ? E2BIG : ENAMETOOLONG);
+		return false;
+	}
+	r = libar2simplified_verify(m.buf, h.buf, cache);
+	if (r < 0)
+		ec = detail::last_error();
+	return r > 0;
+}
+
+
+/**
+ * Calculate a password hash, crypt(3)-style, see
+ * `libar2simplified_crypt`; the salt must be
+ * specified exactly
+ * 
+ * @param   msg       The password, which is copied
+ * @param   paramstr  Hashing parameter string
+ * @param   out       Output parameter for the hashing parameter
+ *                    string with the tag
+ * @return            Error code, empty on success
+ */
+template <std::size_t N>
+inline std::error_code
+crypt(std::string_view msg, std::string_view paramstr, encoded<N> &out) noexcept
+{
+	class params params;
+	class tag tag;
+	std::error_code ec;
+
+	out.clear();
+	ec = params.decode(paramstr);
+	if (!ec)
+		ec = tag.hash(msg, params);
+	if (!ec)
+		ec = out.encode(params, &tag);
+	return ec;
+}
+
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <libblake.h>
+
+
+static void
+expand(const unsigned char *tag, size_t taglen, const struct libar2simplified_subkey *subkey, char *buf)
+{
+	struct libblake_blake2b_params params;
+	struct libblake_blake2b_state state;
+	size_t labellen = strlen(subkey->label);
+	unsigned char out[MAX_SUBKEY_SIZE];
+
+	/* The key is processed as a full, zero-padded, block */
+	memset(buf, 0, 128);
+	memcpy(buf, tag, taglen);
+	memcpy(&buf[128], subkey->label, labellen);
+
+	memset(&params, 0, sizeof(params));
+	params.digest_len = (uint_least8_t)subkey->keylen;
+	params.key_len = (uint_least8_t)taglen;
+	params.fanout = 1;
+	params.depth = 1;
+	memcpy(params.pepper, SUBKEY_PERSONALISATION, sizeof(params.pepper));
+	libblake_blake2b_init(&state, &params);
+	libblake_blake2b_digest(&state, buf, 128 + labellen, 0, subkey->keylen, out);
+	memcpy(subkey->key, out, subkey->keylen);
+
+	libar2_erase(out, sizeof(out));
+	libar2_erase(&state, sizeof(state));
+}
+
+
+int
+libar2simplified_derive_keys(struct libar2simplified_subkey *subkeys, size_t n, void *msg, size_t msglen,
+                             struct libar2_argon2_parameters *params,
+                             const struct libar2simplified_options *opts)
+{
+	unsigned char tag[128]; /* libar2_hash_buf_size may round up */
+	size_t i, j, labellen, maxlabellen = 0, size;
+	char *buf;
+
+	if (!n || !subkeys || params->hashlen < MIN_SUBKEY_TAG_SIZE || params->hashlen > MAX_SUBKEY_SIZE)
+		goto einval;
+	for (i = 0; i < n; i++) {
+		if (!subkeys[i].label || !subkeys[i].key || !subkeys[i].keylen || subkeys[i].keylen > MAX_SUBKEY_SIZE)
+			goto einval;
+		for (j = 0; j < i; j++)
+			if (!strcmp(subkeys[i].label, subkeys[j].label))
+				goto einval;
+		labellen = strlen(subkeys[i].label);
+		if (labellen > maxlabellen)
+			maxlabellen = labellen;
+	}
+
+	/* Allocated up front so that nothing can fail once the hash is calculated */
+	if (maxlabellen > SIZE_MAX - 128)
+		goto enomem;
+	size = libblake_blake2b_digest_get_required_input_size(128 + maxlabellen);
+	buf = malloc(size);
+	if (!buf)
+		goto enomem;
+
+	if (libar2simplified_hash_opt(tag, msg, msglen, params, opts)) {
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		expand(tag, params->hashlen, &subkeys[i], buf);
+
+	libar2_erase(tag, sizeof(tag));
+	libar2_erase(buf, size);
+	free(buf);
+	return 0;
+
+einval:
+	errno = EINVAL;
+	goto fail;
+enomem:
+	errno = ENOMEM;
+fail:
+	libar2_erase(msg, msglen);
+	return -1;
+}
@@ -0,0 +1,10 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+void
+libar2simplified_destroy_context(struct libar2_context *ctxp)
+{
+	free(ctxp->user_data);
+	ctxp->user_data = NULL;
+}
@@ -0,0 +1,179 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <time.h>
+
+
+/* The probes use 64 and 128 MiB matrices, larger than
+ * the last-level caches of most processors, so that
+ * they are dominated by the memory bandwidth, as hashes
+ * with realistic memory costs are; that takes a fraction
+ * of a second, long enough that one run per probe is
+ * not drowned out by the clock's resolution */
+#define PROBE_M_COST 65536
+#define PROBE_REPEATS 1
+
+
+/* All in nanoseconds */
+struct model {
+	double fixed; /* per hash */
+	double per_block; /* per memory block and pass */
+	double per_alloc; /* per memory block, for allocating and initialising it */
+};
+
+
+static pthread_once_t model_once = PTHREAD_ONCE_INIT;
+static struct model model;
+static int model_error = 0;
+
+
+static const char *
+parse_ns(const char *s, double *out)
+{
+	uint_least64_t n = 0;
+	if (!isdigit(*s))
+		return NULL;
+	for (; isdigit(*s); s++) {
+		if (n > (UINT_LEAST64_MAX - (uint_least64_t)(*s & 15)) / 10)
+			return NULL;
+		n = n * 10 + (uint_least64_t)(*s & 15);
+	}
+	*out = (double)n;
+	return s;
+}
+
+
+static int
+read_model(struct model *m)
+{
+	const char *s = getenv("LIBAR2SIMPLIFIED_COST_MODEL");
+	if (!s)
+		return -1;
+	if (!(s = parse_ns(s, &m->fixed)) || *s++ != ',' ||
+	    !(s = parse_ns(s, &m->per_block)) || *s++ != ',' ||
+	    !(s = parse_ns(s, &m->per_alloc)) || *s)
+		return -1;
+	return 0;
+}
+
+
+static int
+probe(uint_least32_t m_cost, uint_least32_t t_cost, double *nsp)
+{
+	unsigned char salt[16], hash[64];
+	char msg[] = "password";
+	struct libar2_argon2_parameters params;
+	struct libar2_context ctx;
+	struct context_data data;
+	struct timespec start, end;
+	double ns;
+	int i;
+
+	memset(salt, 0, sizeof(salt));
+	memset(&params, 0, sizeof(params));
+	params.type = LIBAR2_ARGON2ID;
+	params.version = LIBAR2_ARGON2_VERSION_13;
+	params.t_cost = t_cost;
+	params.m_cost = m_cost;
+	params.lanes = 1;
+	params.salt = salt;
+	params.saltlen = sizeof(salt);
+	params.hashlen = 32;
+
+	/* Hashed directly rather than with libar2simplified_hash_opt
+	 * so that the probes are not counted as hashes */
+	memset(&data, 0, sizeof(data));
+	data.options.max_threads = 1;
+	libar2simplified_init_context(&ctx);
+	ctx.user_data = &data;
+
+	for (i = 0; i < PROBE_REPEATS; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (libar2_hash(hash, msg, sizeof(msg) - 1, &params, &ctx))
+			return -1;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		ns = (double)(end.tv_sec - start.tv_sec) * 1e9 + (double)(end.tv_nsec - start.tv_nsec);
+		if (!i || ns < *nsp)
+			*nsp = ns;
+	}
+
+	return 0;
+}
+
+
+static void
+fit_model(void)
+{
+	double t1, t2, t3, m = PROBE_M_COST;
+
+	if (!read_model(&model))
+		return;
+
+	if (probe(PROBE_M_COST, 1, &t1) ||
+	    probe(PROBE_M_COST, 3, &t2) ||
+	    probe(2 * PROBE_M_COST, 1, &t3)) {
+		model_error = errno;
+		return;
+	}
+
+	/* t1 = fixed + (per_alloc + per_block) m
+	 * t2 = fixed + (per_alloc + 3 per_block) m
+	 * t3 = fixed + (per_alloc + per_block) 2m */
+	model.per_block = (t2 - t1) / (2 * m);
+	if (model.per_block <= 0)
+		model.per_block = t1 / m;
+	model.per_alloc = (t3 - t1) / m - model.per_block;
+	if (model.per_alloc < 0)
+		model.per_alloc = 0;
+	model.fixed = t1 - (model.per_alloc + model.per_block) * m;
+	if (model.fixed < 0)
+		model.fixed = 0;
+}
+
+
+static uint_least64_t
+to_usec(double ns)
+{
+	ns /= 1000;
+	return ns >= (double)UINT_LEAST64_MAX ? UINT_LEAST64_MAX : (uint_least64_t)ns;
+}
+
+
+int
+libar2simplified_estimate(struct libar2simplified_cost *costp, const struct libar2_argon2_parameters *params,
+                          size_t threads)
+{
+	double blocks, serial, parallel;
+	long int nproc;
+
+	if (libar2_validate_params(params, NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_once(&model_once, fit_model);
+	if (model_error) {
+		errno = model_error;
+		return -1;
+	}
+
+	if (!threads) {
+		nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = nproc > 0 ? (size_t)nproc : FALLBACK_NPROC;
+	}
+	/* Like libar2simplified_hash, the lanes are not
+	 * split over threads if they are too small */
+	if (threads > params->lanes)
+		threads = params->lanes;
+	if (params->m_cost / params->lanes < MIN_PARALLEL_LANE_BLOCKS)
+		threads = 1;
+
+	blocks = (double)params->m_cost;
+	serial = model.fixed + model.per_alloc * blocks;
+	parallel = model.per_block * blocks * (double)params->t_cost;
+
+	costp->wall_time = to_usec(serial + parallel / (double)threads);
+	costp->cpu_time = to_usec(serial + parallel);
+	costp->peak_memory = (uint_least64_t)params->m_cost * 1024U + (uint_least64_t)libar2_hash_buf_size(params);
+	costp->threads = threads;
+	return 0;
+}
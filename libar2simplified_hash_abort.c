@@ -0,0 +1,35 @@
+/* See LICENSE file for copyright and license details. */
+#include "stepwise.h"
+#ifdef HAVE_UCONTEXT
+
+
+void
+libar2simplified_hash_abort(struct libar2simplified_hash_state *state)
+{
+	int saved_errno = errno;
+
+	if (state->started) {
+		/* Let the calculation fail, so that
+		 * it erases and releases its memory */
+		state->aborting = 1;
+		swapcontext(&state->caller, &state->calculation);
+	} else {
+		libar2_erase(state->msg, state->msglen);
+	}
+
+	libar2simplified_internal_step_release(state);
+	errno = saved_errno;
+}
+
+
+#else
+
+
+void
+libar2simplified_hash_abort(struct libar2simplified_hash_state *state)
+{
+	(void) state;
+}
+
+
+#endif
@@ -0,0 +1,147 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+struct batch_task {
+	struct libar2simplified_batch_entry *entry;
+	const struct libar2simplified_options *opts;
+	int done;
+};
+
+
+static void
+hash_entry(void *arg)
+{
+	struct batch_task *task = arg;
+	struct libar2simplified_batch_entry *entry = task->entry;
+	if (libar2simplified_hash_opt(entry->hash, entry->msg, entry->msglen, entry->params, task->opts))
+		entry->error = errno;
+	task->done = 1;
+}
+
+
+int
+libar2simplified_hash_batch(struct libar2simplified_batch_entry *entries, size_t n,
+                            const struct libar2simplified_options *opts)
+{
+	struct libar2simplified_options inner;
+	struct libar2_context ctx;
+	struct batch_task *tasks = NULL, task;
+	size_t *indices = NULL, created, i, j, k;
+	int ret = -1, err = 0;
+
+	memset(&inner, 0, sizeof(inner));
+	if (opts)
+		inner = *opts;
+	inner.max_threads = 1;
+
+	for (i = 0; i < n; i++)
+		entries[i].error = 0;
+	if (!n)
+		return 0;
+	i = 0;
+
+	/* The instances are dispatched to the thread pool as if they
+	 * were segments of one hash, so the pool's thread limits,
+	 * priority and cancellation apply to the batch as a whole */
+	if (libar2simplified_init_context_opt(&ctx, opts))
+		goto fail;
+	if (ctx.init_thread_pool(n, &created, &ctx)) {
+		libar2simplified_destroy_context(&ctx);
+		goto fail;
+	}
+
+	if (!created) {
+		libar2simplified_destroy_context(&ctx);
+		for (i = 0; i < n; i++) {
+			if (libar2simplified_internal_check_cancelled(&inner))
+				goto fail;
+			task.entry = &entries[i];
+			task.opts = &inner;
+			hash_entry(&task);
+		}
+		goto done;
+	}
+
+	/* Already accounted for by the pool, which
+	 * also checks for cancellation between instances */
+	inner.priority = LIBAR2SIMPLIFIED_INTERACTIVE;
+	inner.cancel = NULL;
+	inner.deadline.tv_sec = 0;
+	inner.deadline.tv_nsec = 0;
+
+	tasks = malloc(n * sizeof(*tasks));
+	indices = malloc(created * sizeof(*indices));
+	if (!tasks || !indices) {
+		errno = ENOMEM;
+		goto fail_destroy;
+	}
+	for (i = 0; i < n; i++) {
+		tasks[i].entry = &entries[i];
+		tasks[i].opts = &inner;
+		tasks[i].done = 0;
+	}
+
+	for (i = 0; i < n;) {
+		k = ctx.get_ready_threads(indices, created, &ctx);
+		if (!k)
+			goto fail_destroy;
+		for (j = 0; j < k && i < n; j++, i++)
+			if (ctx.run_thread(indices[j], hash_entry, &tasks[i], &ctx))
+				goto fail_destroy;
+	}
+	if (ctx.join_thread_pool(&ctx)) {
+		/* join_thread_pool has destroyed the pool */
+		goto fail_context;
+	}
+	if (ctx.destroy_thread_pool(&ctx))
+		goto fail_context;
+	libar2simplified_destroy_context(&ctx);
+
+done:
+	ret = 0;
+	for (i = 0; i < n; i++) {
+		if (entries[i].error) {
+			errno = entries[i].error;
+			ret = -1;
+			break;
+		}
+	}
+	free(tasks);
+	free(indices);
+	return ret;
+
+fail_destroy:
+	err = errno;
+	ctx.destroy_thread_pool(&ctx);
+	errno = err;
+fail_context:
+	libar2simplified_destroy_context(&ctx);
+	if (tasks) {
+		/* The pool has been destroyed, so every instance that
+		 * was dispatched has finished; those keep their own
+		 * result, and their messages have been erased */
+		err = errno;
+		for (i = 0; i < n; i++) {
+			if (!tasks[i].done) {
+				libar2_erase(entries[i].msg, entries[i].msglen);
+				entries[i].error = err;
+			}
+		}
+		free(tasks);
+		free(indices);
+		errno = err;
+		return -1;
+	}
+fail:
+	/* Entries that were not started have not been erased */
+	err = errno;
+	for (; i < n; i++) {
+		libar2_erase(entries[i].msg, entries[i].msglen);
+		entries[i].error = err;
+	}
+	free(tasks);
+	free(indices);
+	errno = err;
+	return -1;
+}
@@ -0,0 +1,56 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <time.h>
+
+
+int
+libar2simplified_internal_hash(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                               const struct libar2simplified_options *opts, struct libar2simplified_hash_state *stepper)
+{
+	struct libar2_context ctx;
+	struct context_data data;
+	struct timespec start, end;
+	uint_least64_t us;
+	int ret;
+
+	memset(&data, 0, sizeof(data));
+	if (opts)
+		data.options = *opts;
+	data.lane_blocks = params->lanes ? (size_t)(params->m_cost / params->lanes) : 0;
+	data.stepper = stepper;
+	data.count_serial = 1;
+
+	libar2simplified_init_context(&ctx);
+	ctx.autoerase_message = 1;
+	ctx.user_data = &data;
+
+	TRACE4(hash__start, hash, params->m_cost, params->t_cost, params->lanes);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* Don't even start if the request has already expired */
+	ret = libar2simplified_internal_check_cancelled(&data.options);
+	if (!ret)
+		ret = libar2_hash(hash, msg, msglen, params, &ctx);
+	libar2simplified_internal_serial_done(&data);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	us = (uint_least64_t)(end.tv_sec - start.tv_sec) * 1000000;
+	us += (uint_least64_t)(end.tv_nsec / 1000);
+	us -= (uint_least64_t)(start.tv_nsec / 1000);
+	libar2simplified_internal_stats_hash(params, us, ret);
+
+	if (ret) {
+		TRACE2(hash__done, hash, errno);
+		libar2_erase(msg, msglen);
+	} else {
+		TRACE2(hash__done, hash, 0);
+	}
+	return ret;
+}
+
+
+int
+libar2simplified_hash_opt(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                          const struct libar2simplified_options *opts)
+{
+	return libar2simplified_internal_hash(hash, msg, msglen, params, opts, NULL);
+}
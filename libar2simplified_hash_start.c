@@ -0,0 +1,90 @@
+/* See LICENSE file for copyright and license details. */
+#include "stepwise.h"
+#ifdef HAVE_UCONTEXT
+
+
+static void
+calculate(unsigned int hi, unsigned int lo)
+{
+	struct libar2simplified_hash_state *state;
+	state = (void *)(uintptr_t)(((uint_least64_t)hi << 16 << 16) | (uint_least64_t)lo);
+	state->ret = libar2simplified_internal_hash(state->hash, state->msg, state->msglen, state->params,
+	                                            &state->options, state);
+	state->error = errno;
+	state->done = 1;
+	/* Returns to `state->caller` */
+}
+
+
+/* Separate from libar2simplified_hash_start as getcontext(3)
+ * is returns_twice, which would make its locals clobberable */
+static int
+prepare(struct libar2simplified_hash_state *state)
+{
+	uint_least64_t addr;
+
+	if (getcontext(&state->calculation))
+		return -1;
+	state->calculation.uc_stack.ss_sp = state->stack;
+	state->calculation.uc_stack.ss_size = STEP_STACK_SIZE;
+	state->calculation.uc_link = &state->caller;
+	/* makecontext(3) only passes int arguments */
+	addr = (uint_least64_t)(uintptr_t)state;
+	makecontext(&state->calculation, (void (*)(void))calculate, 2,
+	            (unsigned int)(addr >> 16 >> 16), (unsigned int)(addr & 0xFFFFFFFFUL));
+	return 0;
+}
+
+
+struct libar2simplified_hash_state *
+libar2simplified_hash_start(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                            const struct libar2simplified_options *opts)
+{
+	struct libar2simplified_hash_state *state;
+
+	state = calloc(1, sizeof(*state));
+	if (!state)
+		goto enomem;
+	state->stack = malloc(STEP_STACK_SIZE);
+	if (!state->stack)
+		goto enomem;
+
+	state->hash = hash;
+	state->msg = msg;
+	state->msglen = msglen;
+	state->params = params;
+	if (opts)
+		state->options = *opts;
+
+	if (prepare(state))
+		goto fail;
+	return state;
+
+enomem:
+	errno = ENOMEM;
+fail:
+	if (state)
+		free(state->stack);
+	free(state);
+	libar2_erase(msg, msglen);
+	return NULL;
+}
+
+
+#else
+
+
+struct libar2simplified_hash_state *
+libar2simplified_hash_start(void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params,
+                            const struct libar2simplified_options *opts)
+{
+	(void) hash;
+	(void) params;
+	(void) opts;
+	libar2_erase(msg, msglen);
+	errno = ENOSYS;
+	return NULL;
+}
+
+
+#endif
@@ -0,0 +1,103 @@
+/* See LICENSE file for copyright and license details. */
+#include "stepwise.h"
+#ifdef HAVE_UCONTEXT
+
+
+int
+libar2simplified_internal_step_yield(struct libar2simplified_hash_state *state)
+{
+	if (!state->budget && !state->aborting)
+		swapcontext(&state->calculation, &state->caller);
+	if (state->aborting) {
+		errno = ECANCELED;
+		return -1;
+	}
+	state->budget -= 1;
+	return 0;
+}
+
+
+int
+libar2simplified_internal_step_pause(struct libar2simplified_hash_state *state)
+{
+	if (!state->aborting)
+		swapcontext(&state->calculation, &state->caller);
+	if (state->aborting) {
+		errno = ECANCELED;
+		return -1;
+	}
+	return 0;
+}
+
+
+void
+libar2simplified_internal_step_release(struct libar2simplified_hash_state *state)
+{
+	/* The stack held the calculation's working state */
+	libar2_erase(state->stack, STEP_STACK_SIZE);
+	free(state->stack);
+	libar2_erase(state, sizeof(*state));
+	free(state);
+}
+
+
+int
+libar2simplified_hash_step(struct libar2simplified_hash_state *state, size_t budget)
+{
+	int ret, err;
+
+	if (!budget) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	state->budget = budget;
+	state->started = 1;
+	if (swapcontext(&state->caller, &state->calculation))
+		return -1;
+	if (!state->done)
+		return 0;
+
+	ret = state->ret;
+	err = state->error;
+	libar2simplified_internal_step_release(state);
+	if (ret) {
+		errno = err;
+		return -1;
+	}
+	return 1;
+}
+
+
+#else
+
+
+int
+libar2simplified_internal_step_yield(struct libar2simplified_hash_state *state)
+{
+	(void) state;
+	errno = ENOSYS;
+	return -1;
+}
+
+
+int
+libar2simplified_internal_step_pause(struct libar2simplified_hash_state *state)
+{
+	(void) state;
+	errno = ENOSYS;
+	return -1;
+}
+
+
+int
+libar2simplified_hash_step(struct libar2simplified_hash_state *state, size_t budget)
+{
+	(void) state;
+	(void) budget;
+	errno = ENOSYS;
+	return -1;
+}
+
+
+#endif
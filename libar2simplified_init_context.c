@@ -1,123 +1,1108 @@
 /* See LICENSE file for copyright and license details. */
 #include "common.h"
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 
-struct user_data;
+/* Stored in place of the padding size for allocations backed by a file */
+#define FILE_BACKED SIZE_MAX
+
+
+struct worker {
+	struct worker *next; /* in idle_workers */
+	struct thread_data *slot;
+	uint_least64_t idle_timeout;
+	size_t id;
+	sem_t semaphore;
+	unsigned char idle;
+};
 
 struct thread_data {
 	size_t index;
-	struct user_data *master;
-	pthread_t thread;
-	sem_t semaphore;
+	struct thread_pool *master;
+	struct worker *worker;
 	int error;
 	void (*function)(void *data);
 	void *function_input;
 };
 
-struct user_data {
-	struct thread_data *threads;
-	size_t nthreads;
-	pthread_mutex_t mutex;
-	sem_t semaphore;
-	uint_least64_t *joined;
-	uint_least64_t resting[];
-};
+struct thread_pool {
+	struct thread_data *threads;
+	size_t nthreads;
+	unsigned char run_inline;
+	unsigned char cancellable;
+	unsigned char background;
+	unsigned char degraded;
+	const struct libar2simplified_executor *executor;
+	size_t stack_size;
+	uint_least64_t idle_timeout;
+	size_t unreaped; /* dispatched segments whose post to `semaphore` has not been taken */
+	pthread_mutex_t mutex;
+	sem_t semaphore;
+	sem_t released;
+	uint_least64_t *joined;
+	uint_least64_t resting[];
+};
+
+struct erase_job {
+	struct erase_job *next;
+	void *base;
+	size_t size;
+};
+
+
+static pthread_once_t environment_once = PTHREAD_ONCE_INIT;
+static size_t environment_max_threads = 0;
+static int environment_oversubscribe = 0;
+static size_t environment_nproc;
+static size_t environment_background_threads;
+static size_t environment_idle_timeout = 0;
+
+static pthread_mutex_t gate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static atomic_size_t gate_busy = 0;
+static atomic_size_t gate_background_waiting = 0;
+static size_t gate_background_busy = 0;
+
+static pthread_once_t workers_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct worker *idle_workers = NULL;
+static size_t worker_count = 0;
+
+static char *environment_pressure_memory = NULL;
+static char *environment_pressure_cpu = NULL;
+
+static pthread_once_t governor_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t governor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t governor_cond = PTHREAD_COND_INITIALIZER;
+static uint_least64_t governor_sampled = 0;
+static size_t governor_matrices = 0;
+static size_t governor_matrix_limit = SIZE_MAX;
+static size_t governor_thread_limit = SIZE_MAX;
+
+static pthread_once_t eraser_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t eraser_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eraser_cond = PTHREAD_COND_INITIALIZER;
+static struct erase_job *eraser_queue = NULL;
+static size_t eraser_pending = 0;
+static int eraser_running = 0;
+
+
+static int governor_acquire(size_t size, const struct context_data *cdata);
+static void governor_release(size_t size);
+
+
+static void *
+alignedalloc(size_t num, size_t size, size_t extra, size_t alignment)
+{
+	void *ptr;
+	int err;
+	if (num > (SIZE_MAX - extra) / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (alignment < sizeof(void *))
+		alignment = sizeof(void *);
+	err = posix_memalign(&ptr, alignment, num * size + extra);
+	if (err) {
+		errno = err;
+		return NULL;
+	} else {
+		return ptr;
+	}
+}
+
+
+static size_t
+get_page_size(void)
+{
+	long int r = sysconf(_SC_PAGESIZE);
+	return r > 0 ? (size_t)r : 4096;
+}
+
+
+static int
+open_matrix_file(const char *dir)
+{
+	char *path;
+	int fd, saved_errno;
+
+#ifdef O_TMPFILE
+	fd = open(dir, O_TMPFILE | O_RDWR | O_EXCL | O_CLOEXEC, 0600);
+	if (fd >= 0 || (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL))
+		return fd;
+#endif
+
+	/* The file system does not support anonymous files,
+	 * so create a file and remove it immediately */
+	path = malloc(strlen(dir) + sizeof("/ar2s-matrix-XXXXXX"));
+	if (!path) {
+		errno = ENOMEM;
+		return -1;
+	}
+	stpcpy(stpcpy(path, dir), "/ar2s-matrix-XXXXXX");
+	fd = mkstemp(path);
+	if (fd >= 0) {
+		unlink(path);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	saved_errno = errno;
+	free(path);
+	errno = saved_errno;
+	return fd;
+}
+
+
+static char *
+file_backed_alloc(size_t size, size_t alignment, const char *dir)
+{
+	size_t header = get_page_size();
+	char *base;
+	int fd, err;
+
+	/* The header is given a page of its own so
+	 * that the returned pointer is page-aligned */
+	if (alignment > header || size > SIZE_MAX - header || (off_t)(size + header) < 0) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	fd = open_matrix_file(dir);
+	if (fd < 0)
+		return NULL;
+	/* Reserve the storage up front, writing to
+	 * the mapping would raise SIGBUS if it ran out */
+	err = posix_fallocate(fd, 0, (off_t)(size + header));
+	if (err) {
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	base = mmap(NULL, size + header, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if (base == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+
+	/* Reference blocks are read in data-dependent order,
+	 * so read-ahead would mostly read the wrong pages */
+	posix_madvise(&base[header], size, POSIX_MADV_RANDOM);
+
+	return &base[header];
+}
+
+
+static void
+file_backed_free(char *ptr, size_t size)
+{
+	size_t header = get_page_size();
+
+	/* Erasure writes the whole matrix once, front to back */
+	posix_madvise(ptr, size, POSIX_MADV_SEQUENTIAL);
+	libar2_erase(ptr, size);
+	/* Make sure it is the erased contents that is left
+	 * in the released storage, rather than the matrix */
+	msync(&ptr[-(ptrdiff_t)header], size + header, MS_SYNC);
+	munmap(&ptr[-(ptrdiff_t)header], size + header);
+}
+
+
+static void *
+allocate(size_t num, size_t size, size_t alignment, struct libar2_context *ctx)
+{
+	struct context_data *data = ctx->user_data;
+	size_t pad = (alignment - ((2 * sizeof(size_t)) & (alignment - 1))) & (alignment - 1);
+	size_t total;
+	char *ptr;
+
+	/* Checked before the governor is consulted, so that
+	 * nothing needs to be released on this failure */
+	if (num > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	total = num * size;
+
+	if (governor_acquire(total, data))
+		return NULL;
+
+	if (data && data->options.matrix_directory && num >= (MIN_FILE_BACKED_SIZE + size - 1) / size) {
+		ptr = file_backed_alloc(num * size, alignment, data->options.matrix_directory);
+		pad = FILE_BACKED;
+	} else {
+		ptr = alignedalloc(num, size, pad + 2 * sizeof(size_t), alignment);
+		if (ptr)
+			ptr = &ptr[pad];
+	}
+
+	if (ptr) {
+		ptr = &ptr[-(ptrdiff_t)(pad == FILE_BACKED ? 2 * sizeof(size_t) : 0)];
+		*(size_t *)ptr = pad;
+		ptr = &ptr[sizeof(size_t)];
+		*(size_t *)ptr = num * size;
+		ptr = &ptr[sizeof(size_t)];
+		TRACE2(allocate, ptr, num * size);
+		libar2simplified_internal_stats_allocated(num * size);
+	} else {
+		governor_release(total);
+	}
+	return ptr;
+}
+
+
+static void
+set_thread_name(const char *name)
+{
+#if defined(__APPLE__)
+	pthread_setname_np(name);
+#elif defined(__linux__)
+	pthread_setname_np(pthread_self(), name);
+#else
+	(void) name;
+#endif
+}
+
+
+static void *
+eraser_loop(void *data)
+{
+	struct erase_job *job;
+	void *base;
+	size_t size;
+
+	set_thread_name("ar2s-eraser");
+#ifdef SCHED_IDLE
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &(struct sched_param){.sched_priority = 0});
+#endif
+
+	pthread_mutex_lock(&eraser_mutex);
+	for (;;) {
+		while (!eraser_queue)
+			pthread_cond_wait(&eraser_cond, &eraser_mutex);
+		job = eraser_queue;
+		eraser_queue = job->next;
+		pthread_mutex_unlock(&eraser_mutex);
+
+		base = job->base;
+		size = job->size;
+		TRACE2(erase__start, job, size);
+		libar2_erase(job, size);
+		free(base);
+		STATS_SUB(bytes_allocated, size);
+		governor_release(size);
+		TRACE2(erase__done, job, size);
+
+		pthread_mutex_lock(&eraser_mutex);
+		eraser_pending -= size;
+	}
+
+	(void) data;
+	return NULL;
+}
+
+
+static void
+eraser_atfork_prepare(void)
+{
+	pthread_mutex_lock(&eraser_mutex);
+}
+
+
+static void
+eraser_atfork_parent(void)
+{
+	pthread_mutex_unlock(&eraser_mutex);
+}
+
+
+static void
+eraser_atfork_child(void)
+{
+	/* The thread is not inherited, but the queue is,
+	 * so another thread is started when needed */
+	eraser_running = 0;
+	pthread_mutex_unlock(&eraser_mutex);
+}
+
+
+static void
+eraser_init(void)
+{
+	pthread_atfork(eraser_atfork_prepare, eraser_atfork_parent, eraser_atfork_child);
+}
+
+
+static int
+erase_later(void *base, void *ptr, size_t size)
+{
+	struct erase_job *job = ptr;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int err;
+
+	if (size < ASYNC_ERASE_THRESHOLD)
+		return -1;
+	if (pthread_once(&eraser_once, eraser_init))
+		return -1;
+
+	pthread_mutex_lock(&eraser_mutex);
+	if (size > ASYNC_ERASE_MAX_PENDING - eraser_pending)
+		goto fail;
+	if (!eraser_running) {
+		if (pthread_attr_init(&attr))
+			goto fail;
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		err = pthread_create(&thread, &attr, eraser_loop, NULL);
+		pthread_attr_destroy(&attr);
+		if (err)
+			goto fail;
+		eraser_running = 1;
+	}
+	job->base = base;
+	job->size = size;
+	job->next = eraser_queue;
+	eraser_queue = job;
+	eraser_pending += size;
+	pthread_cond_signal(&eraser_cond);
+	pthread_mutex_unlock(&eraser_mutex);
+	return 0;
+
+fail:
+	pthread_mutex_unlock(&eraser_mutex);
+	return -1;
+}
+
+
+static void
+deallocate(void *ptr, struct libar2_context *ctx)
+{
+	struct context_data *data = ctx->user_data;
+	char *p = ptr;
+	size_t size;
+	p -= sizeof(size_t);
+	size = *(size_t *)p;
+	p -= sizeof(size_t);
+	TRACE2(deallocate, ptr, size);
+	if (*(size_t *)p == FILE_BACKED) {
+		file_backed_free(ptr, size);
+		STATS_SUB(bytes_allocated, size);
+		governor_release(size);
+		return;
+	}
+	p -= *(size_t *)p;
+	if (data && data->options.async_erase && !data->options.executor && !erase_later(p, ptr, size))
+		return;
+	libar2_erase(ptr, size);
+	free(p);
+	STATS_SUB(bytes_allocated, size);
+	governor_release(size);
+}
+
+
+static long int
+get_nproc(size_t limit)
+{
+	long int nproc, nproc_limit;
+#ifdef __linux__
+	char path[sizeof("/sys/devices/system/cpu/cpu") + 3 * sizeof(nproc)];
+#endif
+
+	nproc = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef __linux__
+	if (nproc < 1) {
+		nproc_limit = limit > LONG_MAX ? LONG_MAX : (long int)limit;
+		for (nproc = 0; nproc < nproc_limit; nproc++) {
+			sprintf(path, "%s%li", "/sys/devices/system/cpu/cpu", nproc);
+			if (access(path, F_OK))
+				break;
+		}
+	}
+#else
+	(void) limit;
+#endif
+	if (nproc < 1)
+		nproc = FALLBACK_NPROC;
+	return nproc;
+}
+
+
+static const char *
+parse_size(const char *s, size_t *np)
+{
+	size_t digit;
+
+	if (!s || !isdigit(*s))
+		return NULL;
+	for (*np = 0; isdigit(*s); s++) {
+		digit = (size_t)(*s & 15);
+		if (*np > (SIZE_MAX - digit) / 10)
+			return NULL;
+		*np = *np * 10 + digit;
+	}
+	return s;
+}
+
+
+static char *
+join_path(const char *dir, const char *file)
+{
+	char *path = malloc(strlen(dir) + strlen(file) + 2);
+	if (path)
+		stpcpy(stpcpy(stpcpy(path, dir), "/"), file);
+	return path;
+}
+
+
+static void
+read_pressure_paths(const char *dir)
+{
+	/* A cgroup (v2) directory has "memory.pressure"
+	 * and "cpu.pressure", /proc/pressure has
+	 * "memory" and "cpu" */
+	environment_pressure_memory = join_path(dir, "memory.pressure");
+	if (environment_pressure_memory && access(environment_pressure_memory, F_OK)) {
+		free(environment_pressure_memory);
+		environment_pressure_memory = join_path(dir, "memory");
+		environment_pressure_cpu = join_path(dir, "cpu");
+	} else {
+		environment_pressure_cpu = join_path(dir, "cpu.pressure");
+	}
+	if (!environment_pressure_memory || !environment_pressure_cpu) {
+		free(environment_pressure_memory);
+		free(environment_pressure_cpu);
+		environment_pressure_memory = NULL;
+		environment_pressure_cpu = NULL;
+	}
+}
+
+
+static void
+read_environment(void)
+{
+	const char *s;
+	size_t n;
+
+	s = parse_size(getenv("LIBAR2SIMPLIFIED_THREADS"), &n);
+	if (s && (!*s || (*s == '+' && !s[1]))) {
+		environment_max_threads = n;
+		environment_oversubscribe = (*s == '+');
+	}
+
+	environment_nproc = (size_t)get_nproc(SIZE_MAX);
+	environment_background_threads = environment_nproc;
+	s = parse_size(getenv("LIBAR2SIMPLIFIED_BACKGROUND_SHARE"), &n);
+	if (s && !*s && n < 100) {
+		n = environment_nproc * n / 100;
+		environment_background_threads = n ? n : 1;
+	}
+
+	s = parse_size(getenv("LIBAR2SIMPLIFIED_IDLE_TIMEOUT"), &n);
+	if (s && !*s)
+		environment_idle_timeout = n;
+
+	s = getenv("LIBAR2SIMPLIFIED_PRESSURE");
+	if (s && *s)
+		read_pressure_paths(s);
+}
+
+
+static void
+get_thread_policy(const struct context_data *cdata, size_t *max_threadsp, int *oversubscribep)
+{
+	if (cdata && cdata->options.max_threads) {
+		*max_threadsp = cdata->options.max_threads;
+		*oversubscribep = cdata->options.oversubscribe;
+		return;
+	}
+	pthread_once(&environment_once, read_environment);
+	*max_threadsp = environment_max_threads;
+	*oversubscribep = environment_oversubscribe || (cdata && cdata->options.oversubscribe);
+}
+
+
+static void
+gate_enter(const struct thread_pool *pool)
+{
+	size_t limit, background_limit;
+
+	if (!pool->background) {
+		atomic_fetch_add(&gate_busy, 1);
+		return;
+	}
+
+	pthread_once(&environment_once, read_environment);
+	limit = environment_nproc;
+	background_limit = environment_background_threads;
+
+	pthread_mutex_lock(&gate_mutex);
+	atomic_fetch_add(&gate_background_waiting, 1);
+	while (atomic_load(&gate_busy) >= limit || gate_background_busy >= background_limit)
+		pthread_cond_wait(&gate_cond, &gate_mutex);
+	atomic_fetch_sub(&gate_background_waiting, 1);
+	atomic_fetch_add(&gate_busy, 1);
+	gate_background_busy += 1;
+	pthread_mutex_unlock(&gate_mutex);
+}
+
+
+static void
+gate_leave_interactive(void)
+{
+	atomic_fetch_sub(&gate_busy, 1);
+	/* gate_background_waiting is incremented before gate_busy
+	 * is checked, so either the waiter sees the decrement, or
+	 * we see the waiter */
+	if (atomic_load(&gate_background_waiting)) {
+		pthread_mutex_lock(&gate_mutex);
+		pthread_cond_broadcast(&gate_cond);
+		pthread_mutex_unlock(&gate_mutex);
+	}
+}
+
+
+static void
+gate_leave(const struct thread_pool *pool)
+{
+	if (pool->background) {
+		pthread_mutex_lock(&gate_mutex);
+		gate_background_busy -= 1;
+		atomic_fetch_sub(&gate_busy, 1);
+		pthread_cond_broadcast(&gate_cond);
+		pthread_mutex_unlock(&gate_mutex);
+	} else {
+		gate_leave_interactive();
+	}
+}
+
+
+void
+libar2simplified_internal_serial_done(struct context_data *cdata)
+{
+	if (cdata->serial) {
+		cdata->serial = 0;
+		gate_leave_interactive();
+	}
+}
+
+
+static uint_least64_t
+read_pressure(const char *path)
+{
+	char buf[256], *s;
+	uint_least64_t r = 0;
+	ssize_t n;
+	size_t len = 0;
+	int fd, i;
+
+	/* The first line is "some avg10=12.34 avg60=...";
+	 * the value is returned in hundredths of a percent */
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	while (len < sizeof(buf) - 1) {
+		n = read(fd, &buf[len], sizeof(buf) - 1 - len);
+		if (n <= 0) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		len += (size_t)n;
+	}
+	close(fd);
+	buf[len] = '\0';
+
+	if (strncmp(buf, "some avg10=", sizeof("some avg10=") - 1))
+		return 0;
+	s = &buf[sizeof("some avg10=") - 1];
+	for (; isdigit(*s) && r < 10000; s++)
+		r = r * 10 + (uint_least64_t)(*s & 15);
+	r *= 100;
+	if (*s == '.')
+		for (s++, i = 10; i && isdigit(*s); s++, i /= 10)
+			r += (uint_least64_t)(*s & 15) * (uint_least64_t)i;
+	return r;
+}
+
+
+static uint_least64_t
+monotonic_msec(void)
+{
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		return 0;
+	return (uint_least64_t)now.tv_sec * 1000U + (uint_least64_t)now.tv_nsec / 1000000L;
+}
+
+
+static void
+governor_update(void)
+{
+	uint_least64_t memory, cpu, now = monotonic_msec();
+
+	/* Must be called with governor_mutex held */
+	if (governor_sampled && now - governor_sampled < PRESSURE_SAMPLE_INTERVAL)
+		return;
+	governor_sampled = now ? now : 1;
+
+	memory = read_pressure(environment_pressure_memory);
+	cpu = read_pressure(environment_pressure_cpu);
+
+	/* Back off quickly, but recover slowly, so that the
+	 * limits do not oscillate as the averages catch up */
+	if (memory >= PRESSURE_MEMORY_HIGH) {
+		if (governor_matrix_limit > governor_matrices)
+			governor_matrix_limit = governor_matrices;
+		governor_matrix_limit = governor_matrix_limit > 1 ? governor_matrix_limit / 2 : 1;
+	} else if (memory < PRESSURE_MEMORY_LOW && governor_matrix_limit != SIZE_MAX) {
+		if (governor_matrix_limit > governor_matrices)
+			governor_matrix_limit = SIZE_MAX;
+		else
+			governor_matrix_limit += 1;
+		pthread_cond_broadcast(&governor_cond);
+	}
+
+	if (memory >= PRESSURE_MEMORY_HIGH || cpu >= PRESSURE_CPU_HIGH) {
+		if (governor_thread_limit > environment_nproc)
+			governor_thread_limit = environment_nproc;
+		governor_thread_limit = governor_thread_limit > 1 ? governor_thread_limit / 2 : 1;
+	} else if (memory < PRESSURE_MEMORY_LOW && cpu < PRESSURE_CPU_LOW && governor_thread_limit != SIZE_MAX) {
+		governor_thread_limit += 1;
+		if (governor_thread_limit >= environment_nproc)
+			governor_thread_limit = SIZE_MAX;
+	}
+}
+
+
+static void
+governor_atfork_prepare(void)
+{
+	pthread_mutex_lock(&governor_mutex);
+}
+
+
+static void
+governor_atfork_parent(void)
+{
+	pthread_mutex_unlock(&governor_mutex);
+}
+
+
+static void
+governor_atfork_child(void)
+{
+	pthread_mutex_unlock(&governor_mutex);
+}
+
+
+static void
+governor_init(void)
+{
+	pthread_atfork(governor_atfork_prepare, governor_atfork_parent, governor_atfork_child);
+}
+
+
+static int
+governor_acquire(size_t size, const struct context_data *cdata)
+{
+	struct timespec timeout;
+
+	if (size < MIN_GOVERNED_SIZE)
+		return 0;
+	pthread_once(&environment_once, read_environment);
+	if (!environment_pressure_memory)
+		return 0;
+	pthread_once(&governor_once, governor_init);
+
+	pthread_mutex_lock(&governor_mutex);
+	for (;;) {
+		governor_update();
+		if (governor_matrices < governor_matrix_limit)
+			break;
+		if (cdata && cdata->stepper) {
+			/* The caller's event loop must not be blocked, so
+			 * the step returns without progress, and the next
+			 * step tries again */
+			pthread_mutex_unlock(&governor_mutex);
+			if (libar2simplified_internal_step_pause(cdata->stepper))
+				return -1;
+			pthread_mutex_lock(&governor_mutex);
+		} else {
+			/* Wake up at the next sample at the latest,
+			 * as the pressure may have dropped since */
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += PRESSURE_SAMPLE_INTERVAL / 1000;
+			timeout.tv_nsec += (long int)(PRESSURE_SAMPLE_INTERVAL % 1000) * 1000000L;
+			if (timeout.tv_nsec >= 1000000000L) {
+				timeout.tv_nsec -= 1000000000L;
+				timeout.tv_sec += 1;
+			}
+			pthread_cond_timedwait(&governor_cond, &governor_mutex, &timeout);
+		}
+		if (cdata && libar2simplified_internal_check_cancelled(&cdata->options)) {
+			pthread_mutex_unlock(&governor_mutex);
+			return -1;
+		}
+	}
+	governor_matrices += 1;
+	pthread_mutex_unlock(&governor_mutex);
+	return 0;
+}
+
+
+static void
+governor_release(size_t size)
+{
+	if (size < MIN_GOVERNED_SIZE || !environment_pressure_memory)
+		return;
+	pthread_mutex_lock(&governor_mutex);
+	governor_matrices -= 1;
+	pthread_cond_broadcast(&governor_cond);
+	pthread_mutex_unlock(&governor_mutex);
+}
+
+
+static size_t
+governor_threads(size_t desired)
+{
+	pthread_once(&environment_once, read_environment);
+	if (!environment_pressure_memory)
+		return desired;
+	pthread_mutex_lock(&governor_mutex);
+	governor_update();
+	if (desired > governor_thread_limit)
+		desired = governor_thread_limit;
+	pthread_mutex_unlock(&governor_mutex);
+	return desired;
+}
 
 
-static void *
-alignedalloc(size_t num, size_t size, size_t extra, size_t alignment)
+static void
+park_worker(struct worker *worker, struct timespec *deadlinep)
 {
-	void *ptr;
-	int err;
-	if (num > (SIZE_MAX - extra) / size) {
-		errno = ENOMEM;
-		return NULL;
+	uint_least64_t timeout = worker->idle_timeout;
+
+	clock_gettime(CLOCK_REALTIME, deadlinep);
+	if (timeout / 1000 > (uint_least64_t)(LONG_MAX - deadlinep->tv_sec - 1))
+		timeout = (uint_least64_t)(LONG_MAX - deadlinep->tv_sec - 1) * 1000;
+	deadlinep->tv_sec += (time_t)(timeout / 1000);
+	deadlinep->tv_nsec += (long int)(timeout % 1000) * 1000000L;
+	if (deadlinep->tv_nsec >= 1000000000L) {
+		deadlinep->tv_nsec -= 1000000000L;
+		deadlinep->tv_sec += 1;
 	}
-	if (alignment < sizeof(void *))
-		alignment = sizeof(void *);
-	err = posix_memalign(&ptr, alignment, num * size + extra);
-	if (err) {
-		errno = err;
-		return NULL;
-	} else {
-		return ptr;
+
+	pthread_mutex_lock(&idle_mutex);
+	worker->slot = NULL;
+	worker->idle = 1;
+	worker->next = idle_workers;
+	idle_workers = worker;
+	pthread_mutex_unlock(&idle_mutex);
+	STATS_ADD(idle_threads, 1);
+}
+
+
+static int
+reap_worker(struct worker *worker)
+{
+	struct worker **p;
+
+	pthread_mutex_lock(&idle_mutex);
+	if (!worker->idle) {
+		/* Claimed, and about to be posted */
+		pthread_mutex_unlock(&idle_mutex);
+		return 0;
 	}
+	for (p = &idle_workers; *p != worker; p = &(*p)->next);
+	*p = worker->next;
+	pthread_mutex_unlock(&idle_mutex);
+	STATS_SUB(idle_threads, 1);
+	return 1;
 }
 
 
-static void *
-allocate(size_t num, size_t size, size_t alignment, struct libar2_context *ctx)
+static void
+segment_done(struct thread_data *data)
 {
-	size_t pad = (alignment - ((2 * sizeof(size_t)) & (alignment - 1))) & (alignment - 1);
-	char *ptr = alignedalloc(num, size, pad + 2 * sizeof(size_t), alignment);
-	if (ptr) {
-		ptr = &ptr[pad];
-		*(size_t *)ptr = pad;
-		ptr = &ptr[sizeof(size_t)];
-		*(size_t *)ptr = num * size;
-		ptr = &ptr[sizeof(size_t)];
+	struct thread_pool *pool = data->master;
+	int err;
+
+	TRACE2(segment__done, pool, data->index);
+	gate_leave(pool);
+	STATS_SUB(queue_depth, 1);
+
+	err = pthread_mutex_lock(&pool->mutex);
+	if (err) {
+		data->error = err;
+	} else {
+		pool->resting[data->index / 64] |= (uint_least64_t)1 << (data->index % 64);
+		pthread_mutex_unlock(&pool->mutex);
 	}
-	(void) ctx;
-	return ptr;
+	if (sem_post(&pool->semaphore))
+		data->error = errno;
 }
 
 
 static void
-deallocate(void *ptr, struct libar2_context *ctx)
+executor_task(void *data_)
 {
-	char *p = ptr;
-	p -= sizeof(size_t);
-	libar2_erase(ptr, *(size_t *)p);
-	p -= sizeof(size_t);
-	p -= *(size_t *)p;
-	free(p);
-	(void) ctx;
+	struct thread_data *data = data_;
+	TRACE2(segment__start, data->master, data->index);
+	data->function(data->function_input);
+	segment_done(data);
 }
 
 
 static void *
-thread_loop(void *data_)
+worker_loop(void *data_)
 {
-	struct thread_data *data = data_;
-	int err;
+	struct worker *worker = data_;
+	struct thread_data *data;
+	struct thread_pool *pool;
+	struct timespec deadline;
+	char name[16];
+	int r, idle = 0;
+
+	snprintf(name, sizeof(name), "ar2s-worker-%zu", worker->id);
+	set_thread_name(name);
 
 	for (;;) {
-		if (sem_wait(&data->semaphore)) {
+		r = idle ? sem_timedwait(&worker->semaphore, &deadline) : sem_wait(&worker->semaphore);
+		if (r) {
 			if (errno == EINTR)
 				continue;
-			data->error = errno;
-			return NULL;
+			if (errno == ETIMEDOUT && reap_worker(worker))
+				break;
+			idle = 0;
+			continue;
 		}
+		idle = 0;
 
+		data = worker->slot;
+		pool = data->master;
 		if (!data->function) {
-			data->error = ENOTRECOVERABLE;
-			return NULL;
+			/* Released by destroy_thread_pool, which waits for
+			 * `pool->released`, so `data` and `pool` must not
+			 * be touched after it has been posted */
+			if (worker->idle_timeout) {
+				park_worker(worker, &deadline);
+				idle = 1;
+			}
+			sem_post(&pool->released);
+			if (!idle)
+				break;
+			continue;
 		}
+
+		TRACE2(segment__start, pool, data->index);
 		data->function(data->function_input);
+		segment_done(data);
+	}
 
-		err = pthread_mutex_lock(&data->master->mutex);
-		if (err) {
-			data->error = err;
-			return NULL;
-		}
-		data->master->resting[data->index / 64] |= (uint_least64_t)1 << (data->index % 64);
-		pthread_mutex_unlock(&data->master->mutex);
-		if (sem_post(&data->master->semaphore)) {
-			data->error = errno;
-			return NULL;
+	sem_destroy(&worker->semaphore);
+	free(worker);
+	return NULL;
+}
+
+
+static void
+workers_atfork_prepare(void)
+{
+	pthread_mutex_lock(&idle_mutex);
+}
+
+
+static void
+workers_atfork_parent(void)
+{
+	pthread_mutex_unlock(&idle_mutex);
+}
+
+
+static void
+workers_atfork_child(void)
+{
+	/* The threads are not inherited, so
+	 * their records are simply dropped */
+	idle_workers = NULL;
+	atomic_store(&libar2simplified_internal_stats.idle_threads, 0);
+	pthread_mutex_unlock(&idle_mutex);
+}
+
+
+static void
+workers_init(void)
+{
+	pthread_atfork(workers_atfork_prepare, workers_atfork_parent, workers_atfork_child);
+}
+
+
+static struct worker *
+get_worker(const struct thread_pool *pool)
+{
+	struct worker *worker;
+	pthread_attr_t attr;
+	pthread_t thread;
+	size_t stack_size;
+	int err;
+
+	if ((err = pthread_once(&workers_once, workers_init))) {
+		errno = err;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&idle_mutex);
+	worker = idle_workers;
+	if (worker) {
+		idle_workers = worker->next;
+		worker->idle = 0;
+	}
+	pthread_mutex_unlock(&idle_mutex);
+	if (worker) {
+		STATS_SUB(idle_threads, 1);
+		goto out;
+	}
+
+	worker = calloc(1, sizeof(*worker));
+	if (!worker) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (sem_init(&worker->semaphore, 0, 0))
+		goto fail;
+	pthread_mutex_lock(&idle_mutex);
+	worker->id = worker_count++;
+	pthread_mutex_unlock(&idle_mutex);
+
+	err = pthread_attr_init(&attr);
+	if (err)
+		goto fail_sem;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pool->stack_size) {
+		stack_size = pool->stack_size;
+#ifdef PTHREAD_STACK_MIN
+		if (stack_size < (size_t)PTHREAD_STACK_MIN)
+			stack_size = (size_t)PTHREAD_STACK_MIN;
+#endif
+		pthread_attr_setstacksize(&attr, stack_size);
+	}
+	err = pthread_create(&thread, &attr, worker_loop, worker);
+	pthread_attr_destroy(&attr);
+	if (err)
+		goto fail_sem;
+
+out:
+	worker->idle_timeout = pool->idle_timeout;
+	return worker;
+
+fail_sem:
+	sem_destroy(&worker->semaphore);
+	errno = err;
+fail:
+	free(worker);
+	return NULL;
+}
+
+
+static size_t await_threads(size_t *indices, size_t n, size_t require, struct libar2_context *ctx);
+
+
+static int
+is_cancellable(const struct libar2simplified_options *opts)
+{
+	return opts->cancel || opts->deadline.tv_sec || opts->deadline.tv_nsec;
+}
+
+
+int
+libar2simplified_internal_check_cancelled(const struct libar2simplified_options *opts)
+{
+	struct timespec now;
+
+	if (opts->cancel && *opts->cancel) {
+		errno = ECANCELED;
+		return -1;
+	}
+
+	if (opts->deadline.tv_sec || opts->deadline.tv_nsec) {
+		if (clock_gettime(CLOCK_MONOTONIC, &now))
+			return -1;
+		if (now.tv_sec > opts->deadline.tv_sec ||
+		    (now.tv_sec == opts->deadline.tv_sec && now.tv_nsec >= opts->deadline.tv_nsec)) {
+			errno = ETIMEDOUT;
+			return -1;
 		}
 	}
+
+	return 0;
+}
+
+
+static int
+abort_hash(struct libar2_context *ctx)
+{
+	/* Make sure no thread is still working on the memory
+	 * when libar2_hash erases and deallocates it */
+	struct thread_pool *data = ((struct context_data *)ctx->user_data)->pool;
+	int saved_errno = errno;
+	await_threads(NULL, 0, data->nthreads, ctx);
+	errno = saved_errno;
+	return -1;
+}
+
+
+static int
+run_here(struct thread_pool *data, size_t index, void (*function)(void *arg), void *arg)
+{
+	gate_enter(data);
+	TRACE2(dispatch, data, index);
+	TRACE2(segment__start, data, index);
+	function(arg);
+	TRACE2(segment__done, data, index);
+	gate_leave(data);
+	return 0;
 }
 
 
 static int
 run_thread(size_t index, void (*function)(void *arg), void *arg, struct libar2_context *ctx)
 {
-	struct user_data *data = ctx->user_data;
+	struct context_data *cdata = ctx->user_data;
+	struct thread_pool *data = cdata->pool;
 	int err;
 
+	if (cdata->stepper && libar2simplified_internal_step_yield(cdata->stepper))
+		return abort_hash(ctx);
+
+	if (data->cancellable && libar2simplified_internal_check_cancelled(&cdata->options))
+		return abort_hash(ctx);
+
+	if (data->run_inline)
+		return run_here(data, index, function, arg);
+
+	if (!data->executor && !data->threads[index].worker) {
+		if (!data->degraded)
+			data->threads[index].worker = get_worker(data);
+		if (!data->threads[index].worker) {
+			/* A slower hash is better than a failed one, so
+			 * if no thread can be had, for example because of
+			 * RLIMIT_NPROC, the segment is processed here;
+			 * and no more threads are tried for this hash */
+			if (!data->degraded) {
+				data->degraded = 1;
+				TRACE2(degraded, data, errno);
+				STATS_ADD(hashes_degraded, 1);
+			}
+			return run_here(data, index, function, arg);
+		}
+		data->threads[index].worker->slot = &data->threads[index];
+		STATS_ADD(pool_threads, 1);
+	}
+
 	err = pthread_mutex_lock(&data->mutex);
 	if (err) {
 		errno = err;
@@ -133,68 +1118,141 @@ run_thread(size_t index, void (*function)(void *arg), void *arg, struct libar2_c
 
 	data->threads[index].function = function;
 	data->threads[index].function_input = arg;
-	if (sem_post(&data->threads[index].semaphore))
-		return -1;
+	gate_enter(data);
+	TRACE2(dispatch, data, index);
+	STATS_ADD(queue_depth, 1);
+	if (data->executor)
+		err = data->executor->submit(data, executor_task, &data->threads[index], data->executor->user_data);
+	else
+		err = sem_post(&data->threads[index].worker->semaphore);
+	if (err) {
+		err = errno;
+		STATS_SUB(queue_depth, 1);
+		gate_leave(data);
+		pthread_mutex_lock(&data->mutex);
+		data->resting[index / 64] |= (uint_least64_t)1 << (index % 64);
+		pthread_mutex_unlock(&data->mutex);
+		/* libar2 frees the memory when this fails, so the
+		 * segments that have been dispatched must finish first */
+		errno = err;
+		return abort_hash(ctx);
+	}
+	data->unreaped += 1;
 
 	return 0;
 }
 
 
+static void
+release_context_data(struct libar2_context *ctx)
+{
+	struct context_data *cdata = ctx->user_data;
+	cdata->pool = NULL;
+	if (cdata->free_with_pool) {
+		free(cdata);
+		ctx->user_data = NULL;
+	}
+}
+
+
 static int
 destroy_thread_pool(struct libar2_context *ctx)
 {
-	struct user_data *data = ctx->user_data;
-	size_t i;
+	struct thread_pool *data = ((struct context_data *)ctx->user_data)->pool;
+	size_t i, nworkers = 0;
 	int ret = 0;
-	for (i = data->nthreads; i--;)
-		if (run_thread(i, pthread_exit, NULL, ctx))
-			return -1;
 	for (i = data->nthreads; i--;) {
-		pthread_join(data->threads[i].thread, NULL);
-		sem_destroy(&data->threads[i].semaphore);
+		if (!data->threads[i].worker)
+			continue;
+		data->threads[i].function = NULL;
+		if (sem_post(&data->threads[i].worker->semaphore))
+			return -1;
+		nworkers += 1;
+	}
+	while (nworkers) {
+		if (sem_wait(&data->released)) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		STATS_SUB(pool_threads, 1);
+		nworkers -= 1;
+	}
+	if (data->executor) {
+		/* The executor's threads are not released like the workers,
+		 * so the segments still running on them must be waited for
+		 * before their memory and the pool are freed; a segment
+		 * marks itself resting before it posts `semaphore` */
+		await_threads(NULL, 0, data->nthreads, ctx);
+		while (data->unreaped) {
+			if (sem_wait(&data->semaphore)) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			data->unreaped -= 1;
+		}
+	}
+	for (i = data->nthreads; i--;)
 		if (data->threads[i].error)
 			ret = data->threads[i].error;
-	}
+	sem_destroy(&data->released);
 	sem_destroy(&data->semaphore);
 	pthread_mutex_destroy(&data->mutex);
 	free(data->threads);
 	free(data);
+	release_context_data(ctx);
 	return ret;
 }
 
 
-static int
-init_thread_pool(size_t desired, size_t *createdp, struct libar2_context *ctx)
+static size_t
+get_thread_count(const struct context_data *cdata, size_t desired)
 {
-	struct user_data *data;
-	int err;
-	size_t i, size;
-	long int nproc, nproc_limit;
-#ifdef __linux__
-	char path[sizeof("/sys/devices/system/cpu/cpu") + 3 * sizeof(nproc)];
-#endif
+	const struct libar2simplified_executor *executor = cdata ? cdata->options.executor : NULL;
+	int oversubscribe;
+	size_t max_threads, busy, idle, parallelism;
+	long int nproc;
 #ifdef _SC_SEM_VALUE_MAX
 	long int semlimit;
 #endif
 
-	if (desired < 2) {
-		*createdp = 0;
-		return 0;
-	}
+	get_thread_policy(cdata, &max_threads, &oversubscribe);
+	if (max_threads && desired > max_threads)
+		desired = max_threads;
+	desired = governor_threads(desired);
 
-	nproc = sysconf(_SC_NPROCESSORS_ONLN);
-#ifdef __linux__
-	if (nproc < 1) {
-		nproc_limit = desired > LONG_MAX ? LONG_MAX : (long int)desired;
-		for (nproc = 0; nproc < nproc_limit; nproc++) {
-			sprintf(path, "%s%li", "/sys/devices/system/cpu/cpu", nproc);
-			if (access(path, F_OK))
-				break;
+	if (!oversubscribe) {
+		/* Fanning out only pays off if the segments are large
+		 * enough to amortise the dispatch, and if there are
+		 * processors that are not already busy with other hashes;
+		 * otherwise the hash is calculated serially by the caller */
+		if (cdata && cdata->lane_blocks && cdata->lane_blocks < MIN_PARALLEL_LANE_BLOCKS)
+			return 0;
+		if (!executor) {
+			pthread_once(&environment_once, read_environment);
+			busy = atomic_load(&gate_busy);
+			idle = busy < environment_nproc ? environment_nproc - busy : 0;
+			if (desired > idle)
+				desired = idle;
 		}
 	}
-#endif
-	if (nproc < 1)
-		nproc = FALLBACK_NPROC;
+
+	if (desired < 2)
+		return 0;
+
+	if (executor) {
+		/* The application's scheduler balances the load */
+		parallelism = executor->parallelism(executor->user_data);
+		if (desired > parallelism)
+			desired = parallelism;
+		return desired < 2 ? 0 : desired;
+	}
+
+	if (oversubscribe)
+		nproc = desired > LONG_MAX ? LONG_MAX : (long int)desired;
+	else
+		nproc = get_nproc(desired);
 
 #ifdef _SC_SEM_VALUE_MAX
 	semlimit = sysconf(_SC_SEM_VALUE_MAX);
@@ -202,67 +1260,124 @@ init_thread_pool(size_t desired, size_t *createdp, struct libar2_context *ctx)
 		nproc = semlimit;
 #endif
 
-	if (nproc == 1) {
-		*createdp = 0;
+	if (nproc == 1)
 		return 0;
-	}
 
-	desired = (size_t)nproc < desired ? (size_t)nproc : desired;
+	return (size_t)nproc < desired ? (size_t)nproc : desired;
+}
+
+
+static int
+init_thread_pool(size_t desired, size_t *createdp, struct libar2_context *ctx)
+{
+	struct context_data *cdata = ctx->user_data;
+	struct thread_pool *data;
+	int err, run_inline = 0, background;
+	size_t i, size;
+
+	/* The background gate blocks the thread that dispatches the
+	 * work, which with an executor may be one of the executor's
+	 * threads, that other hashes need to make progress, and in a
+	 * stepwise calculation is the caller's event loop, so priority
+	 * is left to the executor's or the caller's scheduling */
+	background = cdata && cdata->options.priority == LIBAR2SIMPLIFIED_BACKGROUND &&
+	             !cdata->options.executor && !cdata->stepper;
+	/* A stepwise calculation must pause between segments,
+	 * so it is always run in the calling thread */
+	desired = cdata && cdata->stepper ? 0 : get_thread_count(cdata, desired);
+	if (!desired) {
+		if (!cdata || (!is_cancellable(&cdata->options) && !background && !cdata->stepper)) {
+			/* The processor is as busy as if the hash had been
+			 * dispatched, which other hashes must know, or they
+			 * would fan out over it */
+			if (cdata && cdata->count_serial && !cdata->serial) {
+				atomic_fetch_add(&gate_busy, 1);
+				cdata->serial = 1;
+			}
+			*createdp = 0;
+			return 0;
+		}
+		/* Run in the calling thread, but through the thread pool
+		 * callbacks so that cancellation can be checked and the
+		 * background gate be honoured; two slots are reported as
+		 * libar2 runs single-threaded if only one thread is reported */
+		desired = 2;
+		run_inline = 1;
+	}
 
 	if (desired > SIZE_MAX - 63 || (desired + 63) / 64 > SIZE_MAX / sizeof(uint_least64_t) / 2) {
 		errno = ENOMEM;
 		return -1;
 	}
+	if (!cdata) {
+		cdata = calloc(1, sizeof(*cdata));
+		if (!cdata) {
+			errno = ENOMEM;
+			return -1;
+		}
+		cdata->free_with_pool = 1;
+		ctx->user_data = cdata;
+	}
+
 	size = (desired + 63) / 64;
 	size *= sizeof(uint_least64_t) * 2;
-	data = alignedalloc(1, offsetof(struct user_data, resting), size, ALIGNOF(struct user_data));
+	data = alignedalloc(1, offsetof(struct thread_pool, resting), size, ALIGNOF(struct thread_pool));
 	if (!data) {
 		errno = ENOMEM;
-		return -1;
+		goto fail;
 	}
-	memset(data, 0, offsetof(struct user_data, resting) + size);
+	memset(data, 0, offsetof(struct thread_pool, resting) + size);
 	data->joined = &data->resting[(desired + 63) / 64];
-	ctx->user_data = data;
+	cdata->pool = data;
 
 	*createdp = data->nthreads = desired;
+	data->run_inline = (unsigned char)run_inline;
+	data->cancellable = (unsigned char)is_cancellable(&cdata->options);
+	data->background = (unsigned char)background;
+	data->executor = cdata->options.executor;
+	data->stack_size = cdata->options.stack_size;
+	data->idle_timeout = (uint_least64_t)cdata->options.idle_timeout;
+	if (!data->idle_timeout) {
+		pthread_once(&environment_once, read_environment);
+		data->idle_timeout = environment_idle_timeout;
+	}
 
 	data->threads = alignedalloc(data->nthreads, sizeof(*data->threads), 0, ALIGNOF(struct thread_data));
 	if (!data->threads)
-		return -1;
+		goto fail_free_pool;
 
 	err = pthread_mutex_init(&data->mutex, NULL);
 	if (err) {
-		free(data->threads);
-		return -1;
+		errno = err;
+		goto fail_free_threads;
 	}
-	err = sem_init(&data->semaphore, 0, 0);
-	if (err) {
-		pthread_mutex_destroy(&data->mutex);
-		free(data->threads);
-		return -1;
+	if (sem_init(&data->semaphore, 0, 0))
+		goto fail_destroy_mutex;
+	if (sem_init(&data->released, 0, 0)) {
+		sem_destroy(&data->semaphore);
+		goto fail_destroy_mutex;
 	}
 
+	/* Workers are assigned to the slots by run_thread
+	 * when work is first dispatched to them */
 	for (i = 0; i < data->nthreads; i++) {
 		memset(&data->threads[i], 0, sizeof(data->threads[i]));
 		data->threads[i].master = data;
 		data->threads[i].index = i;
 		data->resting[i / 64] |= (uint_least64_t)1 << (i % 64);
-		if (sem_init(&data->threads[i].semaphore, 0, 0)) {
-			err = errno;
-			goto fail_post_sem;
-		}
-		err = pthread_create(&data->threads[i].thread, NULL, thread_loop, &data->threads[i]);
-		if (err) {
-			sem_destroy(&data->threads[i].semaphore);
-		fail_post_sem:
-			data->nthreads = i;
-			destroy_thread_pool(ctx);
-			errno = err;
-			return -1;
-		}
 	}
 
 	return 0;
+
+fail_destroy_mutex:
+	pthread_mutex_destroy(&data->mutex);
+fail_free_threads:
+	free(data->threads);
+fail_free_pool:
+	free(data);
+fail:
+	release_context_data(ctx);
+	return -1;
 }
 
 
@@ -283,13 +1398,18 @@ lb(uint_least64_t x)
 static size_t
 await_threads(size_t *indices, size_t n, size_t require, struct libar2_context *ctx)
 {
-	struct user_data *data = ctx->user_data;
+	struct thread_pool *data = ((struct context_data *)ctx->user_data)->pool;
 	size_t ret = 0, i;
 	uint_least64_t one;
 	int err;
 
 	memset(data->joined, 0, (data->nthreads + 63) / 64 * sizeof(*data->joined));
 
+	err = pthread_mutex_lock(&data->mutex);
+	if (err) {
+		errno = err;
+		return 0;
+	}
 	for (i = 0; i < data->nthreads; i += 64) {
 		for (;;) {
 			one = data->resting[i / 64];
@@ -302,9 +1422,23 @@ await_threads(size_t *indices, size_t n, size_t require, struct libar2_context *
 				indices[ret - 1] = i + lb(one);
 		}
 	}
+	pthread_mutex_unlock(&data->mutex);
 
 	for (;;) {
-		if (ret < require) {
+		if (ret < require && data->executor) {
+			/* Let the executor wait, it may want to run
+			 * tasks in this thread in the meanwhile */
+			if (sem_trywait(&data->semaphore)) {
+				if (errno == EAGAIN) {
+					if (data->executor->wait(data, require - ret, data->executor->user_data))
+						return 0;
+					continue;
+				} else if (errno == EINTR) {
+					continue;
+				}
+				return 0;
+			}
+		} else if (ret < require) {
 			if (sem_wait(&data->semaphore)) {
 				if (errno == EINTR)
 					continue;
@@ -316,6 +1450,7 @@ await_threads(size_t *indices, size_t n, size_t require, struct libar2_context *
 			else
 				return 0;
 		}
+		data->unreaped -= 1;
 
 		err = pthread_mutex_lock(&data->mutex);
 		if (err) {
@@ -343,6 +1478,11 @@ await_threads(size_t *indices, size_t n, size_t require, struct libar2_context *
 static size_t
 get_ready_threads(size_t *indices, size_t n, struct libar2_context *ctx)
 {
+	struct context_data *cdata = ctx->user_data;
+	if (cdata->pool->cancellable && libar2simplified_internal_check_cancelled(&cdata->options)) {
+		abort_hash(ctx);
+		return 0;
+	}
 	return await_threads(indices, n, 1, ctx);
 }
 
@@ -350,7 +1490,7 @@ get_ready_threads(size_t *indices, size_t n, struct libar2_context *ctx)
 static int
 join_thread_pool(struct libar2_context *ctx)
 {
-	struct user_data *data = ctx->user_data;
+	struct thread_pool *data = ((struct context_data *)ctx->user_data)->pool;
 	if (await_threads(NULL, 0, data->nthreads, ctx))
 		return 0;
 	destroy_thread_pool(ctx);
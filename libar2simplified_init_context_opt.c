@@ -0,0 +1,21 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+int
+libar2simplified_init_context_opt(struct libar2_context *ctxp, const struct libar2simplified_options *opts)
+{
+	struct context_data *data;
+
+	data = calloc(1, sizeof(*data));
+	if (!data) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (opts)
+		data->options = *opts;
+
+	libar2simplified_init_context(ctxp);
+	ctxp->user_data = data;
+	return 0;
+}
@@ -0,0 +1,54 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+void
+libar2simplified_internal_put_u32(unsigned char *buf, uint_least32_t value)
+{
+	buf[0] = (unsigned char)((value >> 0) & 255);
+	buf[1] = (unsigned char)((value >> 8) & 255);
+	buf[2] = (unsigned char)((value >> 16) & 255);
+	buf[3] = (unsigned char)((value >> 24) & 255);
+}
+
+
+size_t
+libar2simplified_pack(void *buf_, const struct libar2_argon2_parameters *params, const void *hash)
+{
+	unsigned char *buf = buf_;
+	size_t size = LIBAR2SIMPLIFIED_PACK_HEADER_SIZE;
+
+	if (libar2_validate_params(params, NULL) != LIBAR2_OK ||
+	    params->saltlen > (uint_least32_t)0xFFFFFFFFUL ||
+	    params->hashlen > (uint_least32_t)0xFFFFFFFFUL) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if (params->salt)
+		size += params->saltlen;
+	if (hash)
+		size += params->hashlen;
+	if (!buf)
+		return size;
+
+	buf[0] = LIBAR2SIMPLIFIED_PACK_VERSION;
+	buf[1] = (unsigned char)params->type;
+	buf[2] = (unsigned char)params->version;
+	buf[3] = (unsigned char)((params->salt ? PACK_FLAG_SALT : 0) | (hash ? PACK_FLAG_TAG : 0));
+	libar2simplified_internal_put_u32(&buf[4], params->m_cost);
+	libar2simplified_internal_put_u32(&buf[8], params->t_cost);
+	libar2simplified_internal_put_u32(&buf[12], params->lanes);
+	libar2simplified_internal_put_u32(&buf[16], (uint_least32_t)params->saltlen);
+	libar2simplified_internal_put_u32(&buf[20], (uint_least32_t)params->hashlen);
+
+	buf = &buf[LIBAR2SIMPLIFIED_PACK_HEADER_SIZE];
+	if (params->salt) {
+		memcpy(buf, params->salt, params->saltlen);
+		buf = &buf[params->saltlen];
+	}
+	if (hash)
+		memcpy(buf, hash, params->hashlen);
+
+	return size;
+}
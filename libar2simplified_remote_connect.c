@@ -0,0 +1,45 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+int
+libar2simplified_remote_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd, saved_errno;
+
+	if (!path) {
+		path = getenv("LIBAR2SIMPLIFIED_SOCKET");
+		if (!path || !*path)
+			path = LIBAR2SIMPLIFIED_DEFAULT_SOCKET;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+#ifdef SOCK_CLOEXEC
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+	if (fd < 0)
+		return -1;
+
+	while (connect(fd, (const void *)&addr, (socklen_t)sizeof(addr))) {
+		if (errno == EINTR)
+			continue;
+		saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+
+	return fd;
+}
@@ -0,0 +1,149 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <poll.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+
+int
+libar2simplified_internal_send_all(int fd, const void *buf_, size_t len)
+{
+	const unsigned char *buf = buf_;
+	ssize_t r;
+	for (; len; buf = &buf[r], len -= (size_t)r) {
+		r = send(fd, buf, len, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		}
+	}
+	return 0;
+}
+
+
+int
+libar2simplified_internal_recv_all(int fd, void *buf_, size_t len, const struct timespec *deadline)
+{
+	unsigned char *buf = buf_;
+	struct pollfd pfd;
+	struct timespec now;
+	long int timeout;
+	ssize_t r;
+	for (; len; buf = &buf[r], len -= (size_t)r) {
+		r = 0;
+		if (deadline) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > deadline->tv_sec ||
+			    (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec)) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			if (deadline->tv_sec - now.tv_sec > INT_MAX / 1000 - 1)
+				timeout = INT_MAX;
+			else
+				timeout = (long int)(deadline->tv_sec - now.tv_sec) * 1000L +
+				          (deadline->tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			r = poll(&pfd, 1, (int)timeout);
+			if (r < 0) {
+				if (errno != EINTR)
+					return -1;
+				r = 0;
+				continue;
+			} else if (!r) {
+				continue;
+			}
+		}
+		r = recv(fd, buf, len, 0);
+		if (r < 0) {
+			if (errno != EINTR)
+				return -1;
+			r = 0;
+		} else if (!r) {
+			errno = EPROTO;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+int
+libar2simplified_remote_hash(int fd, void *hash, void *msg, size_t msglen, struct libar2_argon2_parameters *params)
+{
+	unsigned char header[LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE];
+	unsigned char *frame = NULL, *p;
+	size_t packlen, keylen, adlen, size = 0;
+	uint_least64_t body;
+	uint_least32_t len, err;
+	int ret = -1;
+
+	keylen = params->key ? params->keylen : 0;
+	adlen = params->ad ? params->adlen : 0;
+	if (!params->salt || msglen > 0xFFFFFFFFUL || keylen > 0xFFFFFFFFUL || adlen > 0xFFFFFFFFUL) {
+		errno = EINVAL;
+		goto out;
+	}
+	packlen = libar2simplified_pack(NULL, params, NULL);
+	if (!packlen)
+		goto out;
+
+	body = (uint_least64_t)packlen + msglen + keylen + adlen;
+	if (body > 0xFFFFFFFFUL || body > SIZE_MAX - LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE) {
+		errno = EINVAL;
+		goto out;
+	}
+	frame = malloc(LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE + (size_t)body);
+	if (!frame)
+		goto out;
+	size = LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE + (size_t)body;
+
+	libar2simplified_internal_put_u32(&frame[0], (uint_least32_t)body);
+	libar2simplified_internal_put_u32(&frame[4], (uint_least32_t)msglen);
+	libar2simplified_internal_put_u32(&frame[8], (uint_least32_t)keylen);
+	libar2simplified_internal_put_u32(&frame[12], (uint_least32_t)adlen);
+	p = &frame[LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE];
+	p = &p[libar2simplified_pack(p, params, NULL)];
+	if (msglen)
+		memcpy(p, msg, msglen);
+	if (keylen)
+		memcpy(&p[msglen], params->key, keylen);
+	if (adlen)
+		memcpy(&p[msglen + keylen], params->ad, adlen);
+
+	if (libar2simplified_internal_send_all(fd, frame, size))
+		goto out;
+
+	if (libar2simplified_internal_recv_all(fd, header, sizeof(header), NULL))
+		goto out;
+	len = libar2simplified_internal_get_u32(&header[0]);
+	err = libar2simplified_internal_get_u32(&header[4]);
+	if (err) {
+		if (len || err > INT_MAX)
+			goto eproto;
+		errno = (int)err;
+		goto out;
+	}
+	if (len != params->hashlen)
+		goto eproto;
+	if (libar2simplified_internal_recv_all(fd, hash, params->hashlen, NULL))
+		goto out;
+
+	ret = 0;
+	goto out;
+
+eproto:
+	errno = EPROTO;
+out:
+	if (frame) {
+		libar2_erase(frame, size);
+		free(frame);
+	}
+	libar2_erase(msg, msglen);
+	return ret;
+}
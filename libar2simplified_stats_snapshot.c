@@ -0,0 +1,65 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+struct stats libar2simplified_internal_stats;
+
+
+void
+libar2simplified_internal_stats_allocated(size_t n)
+{
+	uint_least64_t cur, peak;
+	cur = STATS_ADD(bytes_allocated, (uint_least64_t)n) + (uint_least64_t)n;
+	peak = atomic_load_explicit(&libar2simplified_internal_stats.bytes_allocated_peak, memory_order_relaxed);
+	while (cur > peak)
+		if (atomic_compare_exchange_weak_explicit(&libar2simplified_internal_stats.bytes_allocated_peak, &peak, cur,
+		                                          memory_order_relaxed, memory_order_relaxed))
+			break;
+}
+
+
+void
+libar2simplified_internal_stats_hash(const struct libar2_argon2_parameters *params, uint_least64_t microseconds, int failed)
+{
+	size_t class, bucket = 0;
+
+	if (params->m_cost < (uint_least32_t)1 << 10)
+		class = 0;
+	else if (params->m_cost < (uint_least32_t)1 << 16)
+		class = 1;
+	else if (params->m_cost < (uint_least32_t)1 << 20)
+		class = 2;
+	else
+		class = 3;
+
+	while (microseconds > 1 && bucket < LIBAR2SIMPLIFIED_STATS_BUCKETS - 1) {
+		microseconds >>= 1;
+		bucket += 1;
+	}
+
+	STATS_ADD(latency[class][bucket], 1);
+	if (failed)
+		STATS_ADD(hashes_failed, 1);
+	else
+		STATS_ADD(hashes_completed, 1);
+}
+
+
+void
+libar2simplified_stats_snapshot(struct libar2simplified_stats *statsp)
+{
+	struct stats *s = &libar2simplified_internal_stats;
+	size_t i, j;
+
+	statsp->hashes_completed = atomic_load_explicit(&s->hashes_completed, memory_order_relaxed);
+	statsp->hashes_failed = atomic_load_explicit(&s->hashes_failed, memory_order_relaxed);
+	statsp->bytes_allocated = atomic_load_explicit(&s->bytes_allocated, memory_order_relaxed);
+	statsp->bytes_allocated_peak = atomic_load_explicit(&s->bytes_allocated_peak, memory_order_relaxed);
+	statsp->pool_threads = atomic_load_explicit(&s->pool_threads, memory_order_relaxed);
+	statsp->queue_depth = atomic_load_explicit(&s->queue_depth, memory_order_relaxed);
+	statsp->idle_threads = atomic_load_explicit(&s->idle_threads, memory_order_relaxed);
+	for (i = 0; i < LIBAR2SIMPLIFIED_STATS_CLASSES; i++)
+		for (j = 0; j < LIBAR2SIMPLIFIED_STATS_BUCKETS; j++)
+			statsp->latency[i][j] = atomic_load_explicit(&s->latency[i][j], memory_order_relaxed);
+	statsp->hashes_degraded = atomic_load_explicit(&s->hashes_degraded, memory_order_relaxed);
+}
@@ -0,0 +1,76 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+uint_least32_t
+libar2simplified_internal_get_u32(const unsigned char *buf)
+{
+	uint_least32_t value = 0;
+	value |= (uint_least32_t)buf[0] << 0;
+	value |= (uint_least32_t)buf[1] << 8;
+	value |= (uint_least32_t)buf[2] << 16;
+	value |= (uint_least32_t)buf[3] << 24;
+	return value;
+}
+
+
+struct libar2_argon2_parameters *
+libar2simplified_unpack(const void *buf_, size_t len, const void **hashp, size_t *endp)
+{
+	const unsigned char *buf = buf_;
+	struct libar2_argon2_parameters params, *ret;
+	size_t size = LIBAR2SIMPLIFIED_PACK_HEADER_SIZE, saltsize = 0;
+	int flags;
+
+	if (len < LIBAR2SIMPLIFIED_PACK_HEADER_SIZE || buf[0] != LIBAR2SIMPLIFIED_PACK_VERSION)
+		goto einval;
+	flags = buf[3];
+	if (flags & ~(PACK_FLAG_SALT | PACK_FLAG_TAG))
+		goto einval;
+
+	memset(&params, 0, sizeof(params));
+	params.type = (enum libar2_argon2_type)buf[1];
+	params.version = (enum libar2_argon2_version)buf[2];
+	params.m_cost = libar2simplified_internal_get_u32(&buf[4]);
+	params.t_cost = libar2simplified_internal_get_u32(&buf[8]);
+	params.lanes = libar2simplified_internal_get_u32(&buf[12]);
+	params.saltlen = (size_t)libar2simplified_internal_get_u32(&buf[16]);
+	params.hashlen = (size_t)libar2simplified_internal_get_u32(&buf[20]);
+	if (libar2_validate_params(&params, NULL) != LIBAR2_OK)
+		goto einval;
+
+	if (flags & PACK_FLAG_SALT) {
+		saltsize = params.saltlen;
+		if (saltsize > len - size)
+			goto einval;
+		size += saltsize;
+	}
+	if (flags & PACK_FLAG_TAG) {
+		if (params.hashlen > len - size)
+			goto einval;
+		if (hashp)
+			*hashp = &buf[size];
+		size += params.hashlen;
+	} else if (hashp) {
+		*hashp = NULL;
+	}
+
+	ret = malloc(sizeof(params) + saltsize);
+	if (!ret) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(ret, &params, sizeof(params));
+	if (flags & PACK_FLAG_SALT) {
+		ret->salt = &((unsigned char *)ret)[sizeof(params)];
+		memcpy(ret->salt, &buf[LIBAR2SIMPLIFIED_PACK_HEADER_SIZE], saltsize);
+	}
+
+	if (endp)
+		*endp = size;
+	return ret;
+
+einval:
+	errno = EINVAL;
+	return NULL;
+}
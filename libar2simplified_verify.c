@@ -0,0 +1,369 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <libblake.h>
+#include <time.h>
+
+
+/* A verification in progress; identical concurrent
+ * verifications wait for it rather than hashing */
+struct flight {
+	struct flight *next;
+	unsigned char mac[VERIFY_CACHE_MAC_SIZE];
+	size_t waiters;
+	int done;
+	int verdict;
+	int error;
+};
+
+
+static pthread_once_t flight_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t flight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flight_cond = PTHREAD_COND_INITIALIZER;
+static struct flight *flights = NULL;
+static unsigned char flight_key[VERIFY_CACHE_KEY_SIZE];
+static int have_flight_key = 0;
+
+
+static int
+no_random_salt(char *out, size_t n)
+{
+	(void) out;
+	(void) n;
+	errno = EINVAL;
+	return -1;
+}
+
+
+static int
+compute_mac(const unsigned char *key, const char *msg, size_t msglen, const char *hashstr, unsigned char *mac)
+{
+	struct libblake_blake2b_params params;
+	struct libblake_blake2b_state state;
+	size_t hashstrlen = strlen(hashstr);
+	size_t len, size;
+	char *buf;
+
+	/* The key is processed as a full, zero-padded, block */
+	len = 128;
+	if (hashstrlen + 1 > SIZE_MAX - len || msglen > SIZE_MAX - len - (hashstrlen + 1))
+		goto enomem;
+	len += hashstrlen + 1 + msglen;
+	size = libblake_blake2b_digest_get_required_input_size(len);
+	buf = malloc(size);
+	if (!buf)
+		goto enomem;
+
+	memset(buf, 0, 128);
+	memcpy(buf, key, VERIFY_CACHE_KEY_SIZE);
+	memcpy(&buf[128], hashstr, hashstrlen + 1);
+	memcpy(&buf[128 + hashstrlen + 1], msg, msglen);
+
+	memset(&params, 0, sizeof(params));
+	params.digest_len = VERIFY_CACHE_MAC_SIZE;
+	params.key_len = VERIFY_CACHE_KEY_SIZE;
+	params.fanout = 1;
+	params.depth = 1;
+	libblake_blake2b_init(&state, &params);
+	libblake_blake2b_digest(&state, buf, len, 0, VERIFY_CACHE_MAC_SIZE, mac);
+
+	libar2_erase(buf, size);
+	libar2_erase(&state, sizeof(state));
+	free(buf);
+	return 0;
+
+enomem:
+	errno = ENOMEM;
+	return -1;
+}
+
+
+static uint_least64_t
+now_msec(void)
+{
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now))
+		return 0;
+	return (uint_least64_t)now.tv_sec * 1000U + (uint_least64_t)now.tv_nsec / 1000000L;
+}
+
+
+static size_t *
+find(struct libar2simplified_verify_cache *cache, const unsigned char *mac)
+{
+	uint_least64_t h = 0;
+	size_t *linkp, i;
+
+	for (i = 0; i < 8; i++)
+		h = (h << 8) | mac[i];
+	linkp = &cache->buckets[(size_t)h & cache->mask];
+	for (; *linkp != VERIFY_CACHE_NONE; linkp = &cache->entries[*linkp].chain)
+		if (!memcmp(cache->entries[*linkp].mac, mac, VERIFY_CACHE_MAC_SIZE))
+			break;
+	return linkp;
+}
+
+
+static void
+unlink_lru(struct libar2simplified_verify_cache *cache, size_t i)
+{
+	struct verify_cache_entry *e = &cache->entries[i];
+	if (e->newer == VERIFY_CACHE_NONE)
+		cache->newest = e->older;
+	else
+		cache->entries[e->newer].older = e->older;
+	if (e->older == VERIFY_CACHE_NONE)
+		cache->oldest = e->newer;
+	else
+		cache->entries[e->older].newer = e->newer;
+}
+
+
+static void
+push_lru(struct libar2simplified_verify_cache *cache, size_t i)
+{
+	struct verify_cache_entry *e = &cache->entries[i];
+	e->newer = VERIFY_CACHE_NONE;
+	e->older = cache->newest;
+	if (cache->newest == VERIFY_CACHE_NONE)
+		cache->oldest = i;
+	else
+		cache->entries[cache->newest].newer = i;
+	cache->newest = i;
+}
+
+
+static void
+drop(struct libar2simplified_verify_cache *cache, size_t *linkp)
+{
+	size_t i = *linkp;
+	*linkp = cache->entries[i].chain;
+	unlink_lru(cache, i);
+	libar2_erase(&cache->entries[i], sizeof(cache->entries[i]));
+	cache->entries[i].chain = cache->free;
+	cache->free = i;
+}
+
+
+static int
+lookup(struct libar2simplified_verify_cache *cache, const unsigned char *mac)
+{
+	size_t *linkp, i;
+	int ret = -1;
+
+	pthread_mutex_lock(&cache->mutex);
+	linkp = find(cache, mac);
+	i = *linkp;
+	if (i != VERIFY_CACHE_NONE) {
+		if (cache->entries[i].expires <= now_msec()) {
+			drop(cache, linkp);
+		} else {
+			unlink_lru(cache, i);
+			push_lru(cache, i);
+			ret = cache->entries[i].verdict;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+
+static void
+store(struct libar2simplified_verify_cache *cache, const unsigned char *mac, int verdict)
+{
+	size_t *linkp, i;
+
+	pthread_mutex_lock(&cache->mutex);
+	linkp = find(cache, mac);
+	i = *linkp;
+	if (i == VERIFY_CACHE_NONE) {
+		if (cache->free == VERIFY_CACHE_NONE)
+			drop(cache, find(cache, cache->entries[cache->oldest].mac));
+		i = cache->free;
+		cache->free = cache->entries[i].chain;
+		memcpy(cache->entries[i].mac, mac, VERIFY_CACHE_MAC_SIZE);
+		linkp = find(cache, mac);
+		cache->entries[i].chain = VERIFY_CACHE_NONE;
+		*linkp = i;
+	} else {
+		unlink_lru(cache, i);
+	}
+	push_lru(cache, i);
+	cache->entries[i].verdict = (unsigned char)verdict;
+	cache->entries[i].expires = now_msec() + cache->ttl;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+
+static void
+flight_atfork_prepare(void)
+{
+	pthread_mutex_lock(&flight_mutex);
+}
+
+
+static void
+flight_atfork_parent(void)
+{
+	pthread_mutex_unlock(&flight_mutex);
+}
+
+
+static void
+flight_atfork_child(void)
+{
+	/* The threads computing the flights
+	 * are not inherited, so nobody would
+	 * land them */
+	flights = NULL;
+	pthread_mutex_unlock(&flight_mutex);
+}
+
+
+static void
+flight_init(void)
+{
+	pthread_atfork(flight_atfork_prepare, flight_atfork_parent, flight_atfork_child);
+	/* Without a key, verifications are simply not coalesced */
+	have_flight_key = !libar2simplified_internal_random_key(flight_key, sizeof(flight_key));
+}
+
+
+static int
+join_flight(struct flight *flight, int *verdictp)
+{
+	struct flight *f;
+	int err;
+
+	pthread_mutex_lock(&flight_mutex);
+	for (f = flights; f; f = f->next)
+		if (!memcmp(f->mac, flight->mac, VERIFY_CACHE_MAC_SIZE))
+			break;
+	if (!f) {
+		flight->waiters = 0;
+		flight->done = 0;
+		flight->next = flights;
+		flights = flight;
+		pthread_mutex_unlock(&flight_mutex);
+		return 0;
+	}
+
+	f->waiters += 1;
+	while (!f->done)
+		pthread_cond_wait(&flight_cond, &flight_mutex);
+	*verdictp = f->verdict;
+	err = f->error;
+	if (!--f->waiters)
+		pthread_cond_broadcast(&flight_cond);
+	pthread_mutex_unlock(&flight_mutex);
+
+	if (*verdictp < 0)
+		errno = err;
+	return 1;
+}
+
+
+static void
+land_flight(struct flight *flight, int verdict)
+{
+	struct flight **p;
+	int err = errno;
+
+	pthread_mutex_lock(&flight_mutex);
+	for (p = &flights; *p != flight; p = &(*p)->next);
+	*p = flight->next;
+	flight->verdict = verdict;
+	flight->error = err;
+	flight->done = 1;
+	pthread_cond_broadcast(&flight_cond);
+	/* The waiters read the result from `flight`,
+	 * which is on the stack of this thread */
+	while (flight->waiters)
+		pthread_cond_wait(&flight_cond, &flight_mutex);
+	pthread_mutex_unlock(&flight_mutex);
+
+	errno = err;
+}
+
+
+static int
+equal(const char *a, const char *b, size_t blen)
+{
+	size_t alen = strlen(a), i;
+	unsigned char diff = 0;
+
+	if (alen != blen)
+		return 0;
+	for (i = 0; i < alen; i++)
+		diff |= (unsigned char)(a[i] ^ b[i]);
+	return !diff;
+}
+
+
+int
+libar2simplified_verify(char *msg, const char *hashstr, struct libar2simplified_verify_cache *cache)
+{
+	struct libar2_argon2_parameters *params = NULL;
+	unsigned char mac[VERIFY_CACHE_MAC_SIZE];
+	struct flight flight;
+	char *tag, *end, *hash = NULL, *encoded = NULL;
+	size_t msglen = strlen(msg), size = 0;
+	int ret = -1, in_flight = 0;
+
+	if (cache) {
+		if (compute_mac(cache->key, msg, msglen, hashstr, mac))
+			goto out;
+		ret = lookup(cache, mac);
+		if (ret >= 0)
+			goto out;
+	}
+
+	pthread_once(&flight_once, flight_init);
+	if (have_flight_key) {
+		if (compute_mac(flight_key, msg, msglen, hashstr, flight.mac))
+			goto out;
+		if (join_flight(&flight, &ret))
+			goto out;
+		in_flight = 1;
+	}
+
+	params = libar2simplified_decode(hashstr, &tag, &end, no_random_salt);
+	if (!params)
+		goto out;
+	if (!tag || *end) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	size = libar2_hash_buf_size(params);
+	if (!size || !(hash = malloc(size))) {
+		errno = ENOMEM;
+		goto out;
+	}
+	if (libar2simplified_hash(hash, msg, msglen, params))
+		goto out;
+	encoded = libar2simplified_encode_hash(params, hash);
+	if (!encoded)
+		goto out;
+
+	ret = equal(encoded, tag, (size_t)(end - tag));
+	if (cache)
+		store(cache, mac, ret);
+
+out:
+	if (in_flight)
+		land_flight(&flight, ret);
+	libar2_erase(msg, msglen);
+	libar2_erase(mac, sizeof(mac));
+	libar2_erase(flight.mac, sizeof(flight.mac));
+	if (params)
+		libar2_erase(params->salt, params->saltlen);
+	if (hash)
+		libar2_erase(hash, size);
+	if (encoded)
+		libar2_erase(encoded, strlen(encoded));
+	free(params);
+	free(hash);
+	free(encoded);
+	return ret;
+}
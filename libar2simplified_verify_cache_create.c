@@ -0,0 +1,110 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+
+
+int
+libar2simplified_internal_random_key(unsigned char *out, size_t n)
+{
+	size_t i = 0;
+	ssize_t r;
+	int fd, saved_errno = errno;
+
+#ifdef __linux__
+	for (; i < n; i += (size_t)r) {
+		r = getrandom(&out[i], n - i, GRND_NONBLOCK);
+		if (r < 0) {
+			if (errno == EINTR)
+				r = 0;
+			else
+				break;
+		}
+	}
+#endif
+	if (i == n)
+		goto out;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	for (; i < n; i += (size_t)r) {
+		r = read(fd, &out[i], n - i);
+		if (r < 0 && errno == EINTR)
+			r = 0;
+		else if (r <= 0)
+			break;
+	}
+	if (i < n) {
+		if (!r)
+			errno = EIO;
+		saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+		return -1;
+	}
+	close(fd);
+
+out:
+	errno = saved_errno;
+	return 0;
+}
+
+
+struct libar2simplified_verify_cache *
+libar2simplified_verify_cache_create(size_t capacity, unsigned long int ttl_msec)
+{
+	struct libar2simplified_verify_cache *cache;
+	size_t i, nbuckets;
+	int err;
+
+	if (!capacity || capacity == VERIFY_CACHE_NONE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	for (nbuckets = 1; nbuckets < capacity; nbuckets <<= 1)
+		if (nbuckets > SIZE_MAX / 2 / sizeof(*cache->buckets))
+			goto enomem;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		goto enomem;
+	cache->buckets = malloc(nbuckets * sizeof(*cache->buckets));
+	cache->entries = calloc(capacity, sizeof(*cache->entries));
+	if (!cache->buckets || !cache->entries)
+		goto fail_enomem;
+
+	if (libar2simplified_internal_random_key(cache->key, sizeof(cache->key)))
+		goto fail;
+	err = pthread_mutex_init(&cache->mutex, NULL);
+	if (err) {
+		errno = err;
+		goto fail;
+	}
+
+	cache->ttl = (uint_least64_t)ttl_msec;
+	cache->capacity = capacity;
+	cache->mask = nbuckets - 1;
+	for (i = 0; i < nbuckets; i++)
+		cache->buckets[i] = VERIFY_CACHE_NONE;
+	for (i = 0; i < capacity; i++)
+		cache->entries[i].chain = i + 1 < capacity ? i + 1 : VERIFY_CACHE_NONE;
+	cache->free = 0;
+	cache->newest = cache->oldest = VERIFY_CACHE_NONE;
+	return cache;
+
+fail_enomem:
+	errno = ENOMEM;
+fail:
+	libar2_erase(cache->key, sizeof(cache->key));
+	free(cache->buckets);
+	free(cache->entries);
+	free(cache);
+	return NULL;
+
+enomem:
+	errno = ENOMEM;
+	return NULL;
+}
@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+
+void
+libar2simplified_verify_cache_destroy(struct libar2simplified_verify_cache *cache)
+{
+	if (!cache)
+		return;
+	pthread_mutex_destroy(&cache->mutex);
+	libar2_erase(cache->entries, cache->capacity * sizeof(*cache->entries));
+	libar2_erase(cache->key, sizeof(cache->key));
+	free(cache->buckets);
+	free(cache->entries);
+	free(cache);
+}
@@ -0,0 +1,54 @@
+/* See LICENSE file for copyright and license details. */
+#include "common.h"
+
+/* getcontext(3) and makecontext(3) were removed from POSIX, and
+ * some systems, such as musl-based ones, macOS, and Windows, do not
+ * provide working implementations; there, the stepwise API fails
+ * with ENOSYS */
+#if !defined(NO_UCONTEXT) && (defined(__GLIBC__) || defined(__FreeBSD__) || defined(__NetBSD__) ||\
+                              defined(__DragonFly__) || defined(__sun))
+# if defined(__has_include)
+#  if __has_include(<ucontext.h>)
+#   define HAVE_UCONTEXT
+#  endif
+# else
+#  define HAVE_UCONTEXT
+# endif
+#endif
+
+#ifdef HAVE_UCONTEXT
+# include <ucontext.h>
+
+
+/* The stack size for the calculation in
+ * `struct libar2simplified_hash_state` */
+#ifndef STEP_STACK_SIZE
+# define STEP_STACK_SIZE ((size_t)512 << 10)
+#endif
+
+
+/* The calculation runs on its own stack, and switches back
+ * to the caller of `libar2simplified_hash_step` whenever
+ * it has processed its budget of segments */
+struct libar2simplified_hash_state {
+	ucontext_t caller;
+	ucontext_t calculation;
+	void *stack;
+	void *hash;
+	void *msg;
+	size_t msglen;
+	struct libar2_argon2_parameters *params;
+	struct libar2simplified_options options;
+	size_t budget;
+	unsigned char started;
+	unsigned char aborting;
+	unsigned char done;
+	int ret;
+	int error;
+};
+
+
+/* libar2simplified_hash_step.c */
+HIDDEN void libar2simplified_internal_step_release(struct libar2simplified_hash_state *state);
+
+#endif
@@ -0,0 +1,109 @@
+/* See LICENSE file for copyright and license details. */
+#include "libar2simplified.hpp"
+
+#include <cstdlib>
+
+
+#define assert(TRUTH) assert_(TRUTH, #TRUTH, __LINE__)
+#define assert_streq(RESULT, EXPECT) assert_streq_(RESULT, EXPECT, #RESULT, __LINE__)
+
+#define HASH "$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$nf65EOgLrQMR/uIPnA4rEsF5h7TKyQwu9U1bMCHGi/4"
+#define RECOMMENDATION "$argon2id$v=19$m=3072,t=32,p=4$*16$*48"
+
+
+using namespace libar2simplified;
+
+
+/* Parsed, and checked, at compile time */
+constexpr fixed_params recommendation = parse_params(RECOMMENDATION);
+static_assert(recommendation.type == LIBAR2_ARGON2ID);
+static_assert(recommendation.version == LIBAR2_ARGON2_VERSION_13);
+static_assert(recommendation.m_cost == 3072 && recommendation.t_cost == 32 && recommendation.lanes == 4);
+static_assert(recommendation.saltlen == 16);
+static_assert(recommendation.hashlen == 48);
+
+
+static void
+assert_(bool truth, const char *truthstr, int lineno)
+{
+	if (!truth) {
+		std::fprintf(stderr, "Assertion at line %i failed: %s\n", lineno, truthstr);
+		std::exit(1);
+	}
+}
+
+
+static void
+assert_streq_(std::string_view result, std::string_view expect, const char *code, int lineno)
+{
+	if (result != expect) {
+		std::fprintf(stderr, "Assertion at line %i failed:\n", lineno);
+		std::fprintf(stderr, "\tcode:     %s\n", code);
+		std::fprintf(stderr, "\tresult:   %.*s\n", (int)result.size(), result.data());
+		std::fprintf(stderr, "\texpected: %.*s\n", (int)expect.size(), expect.data());
+		std::exit(1);
+	}
+}
+
+
+static void
+check_known_vector(void)
+{
+	class params params;
+	class tag tag;
+	encoded<> out, crypted;
+	std::string_view expected_tag;
+	std::error_code ec;
+
+	assert(!params.decode(HASH, &expected_tag));
+	assert(expected_tag.size() == 43);
+	assert(params.get().hashlen == 32);
+	assert(!tag.hash("password", params));
+	assert(tag.size() == 32);
+	assert(!out.encode(params, &tag));
+	assert_streq(out.view(), HASH);
+
+	assert(!out.encode(params));
+	assert_streq(out.view(), "$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32");
+
+	assert(!crypt("password", out.view(), crypted));
+	assert_streq(crypted.view(), HASH);
+
+	assert(verify("password", HASH, ec) && !ec);
+	assert(!verify("wrong password", HASH, ec) && !ec);
+	assert(!verify("password", "$argon2id$v=19$m=256", ec) && ec);
+}
+
+
+static void
+check_assign(void)
+{
+	class params params, decoded;
+	encoded<> out;
+	std::string_view tag;
+
+	assert(!params.assign(recommendation));
+	assert(!out.encode(params));
+	assert(out.view().substr(0, sizeof("$argon2id$v=19$m=3072,t=32,p=4$") - 1) == "$argon2id$v=19$m=3072,t=32,p=4$");
+	assert(out.view().substr(out.size() - 4) == "$*48");
+
+	assert(!decoded.decode(out.view(), &tag));
+	assert(tag.empty());
+	assert(decoded.get().type == recommendation.type);
+	assert(decoded.get().version == recommendation.version);
+	assert(decoded.get().m_cost == recommendation.m_cost);
+	assert(decoded.get().t_cost == recommendation.t_cost);
+	assert(decoded.get().lanes == recommendation.lanes);
+	assert(decoded.get().saltlen == recommendation.saltlen);
+	assert(decoded.get().hashlen == recommendation.hashlen);
+	assert(!std::memcmp(decoded.get().salt, params.get().salt, recommendation.saltlen));
+}
+
+
+int
+main(void)
+{
+	check_known_vector();
+	check_assign();
+	return 0;
+}
@@ -3,6 +3,8 @@
 #ifdef __linux__
 #include <sys/random.h>
 #endif
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <time.h>
 #ifndef CLOCK_MONOTONIC_RAW
 # define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
@@ -119,6 +121,106 @@ check_hash(const char *pwd, size_t pwdlen, const char *input, const char *output
 }
 
 
+static void
+check_hash_opt(const char *pwd, const char *hash, const struct libar2simplified_options *opts, int lineno)
+{
+	struct libar2_argon2_parameters *params;
+	char tag_buf[512], pwd_buf[512], *output_got;
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode(hash, NULL, NULL, NULL)));
+	strcpy(pwd_buf, pwd);
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd), params, opts));
+	output_got = libar2simplified_encode(params, tag_buf);
+	assert_streq(output_got, hash);
+	free(output_got);
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_matrix_directory_failure(void)
+{
+	struct libar2simplified_options opts = {.matrix_directory = "/nonexistent/directory"};
+	struct libar2_argon2_parameters *params;
+	char tag_buf[512], pwd_buf[] = "password";
+
+	from_lineno = __LINE__;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode("$argon2id$v=19$m=2048,t=1,p=1$c29tZXNhbHQ$*32", NULL, NULL, NULL)));
+	assert(libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts) == -1);
+	assert(errno == ENOENT);
+	errno = 0;
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_hash_batch(const struct libar2simplified_options *opts, int lineno)
+{
+	static const char *const hashes[] = {
+		"$argon2i$v=19$m=256,t=2,p=1$c29tZXNhbHQ$iekCn0Y3spW+sCcFanM2xBT63UP2sghkUoHLIUpWRS8",
+		"$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$nf65EOgLrQMR/uIPnA4rEsF5h7TKyQwu9U1bMCHGi/4",
+		"$argon2i$v=19$m=256,t=2,p=2$c29tZXNhbHQ$T/XOJ2mh1/TIpJHfCdQan76Q5esCFVoT5MAeIM1Oq2E",
+		"$argon2d$v=16$m=8,t=1,p=1$ICAgICAgICA$X54KZYxUSfMUihzebb70sKbheabHilo8gsUldrVU4IU"
+	};
+	static const char *const pwds[] = {"password", "password", "password", ""};
+#define N (sizeof(hashes) / sizeof(*hashes))
+	struct libar2simplified_batch_entry entries[N];
+	struct libar2simplified_options cancelled;
+	volatile sig_atomic_t cancel = 1;
+	char tag_bufs[N][512], pwd_bufs[N][16], *output_got;
+	size_t i;
+
+	from_lineno = lineno;
+	errno = 0;
+
+	for (i = 0; i < N; i++) {
+		strcpy(pwd_bufs[i], pwds[i]);
+		entries[i].hash = tag_bufs[i];
+		entries[i].msg = pwd_bufs[i];
+		entries[i].msglen = strlen(pwds[i]);
+		assert(!!(entries[i].params = libar2simplified_decode(hashes[i], NULL, NULL, NULL)));
+		entries[i].error = -1;
+	}
+	assert(!libar2simplified_hash_batch(entries, N, opts));
+	for (i = 0; i < N; i++) {
+		assert(!entries[i].error);
+		assert(!*pwd_bufs[i]);
+		output_got = libar2simplified_encode(entries[i].params, tag_bufs[i]);
+		assert_streq(output_got, hashes[i]);
+		free(output_got);
+	}
+
+	if (opts)
+		cancelled = *opts;
+	else
+		memset(&cancelled, 0, sizeof(cancelled));
+	cancelled.cancel = &cancel;
+	for (i = 0; i < N; i++)
+		strcpy(pwd_bufs[i], pwds[i]);
+	assert(libar2simplified_hash_batch(entries, N, &cancelled) == -1);
+	assert(errno == ECANCELED);
+	for (i = 0; i < N; i++) {
+		assert(entries[i].error == ECANCELED);
+		assert(!*pwd_bufs[i]);
+		free(entries[i].params);
+	}
+
+	assert(!libar2simplified_hash_batch(NULL, 0, opts));
+#undef N
+
+	from_lineno = 0;
+}
+
+
 #ifdef __linux__
 static ssize_t getrandom_return = -1;
 static char getrandom_random0;
@@ -185,6 +287,1077 @@ check_random_salt_generate(void)
 }
 
 
+static void
+check_stats(void)
+{
+	struct libar2simplified_stats stats;
+	uint_least64_t sum = 0;
+	size_t i, j;
+
+	libar2simplified_stats_snapshot(&stats);
+	assert(stats.hashes_completed > 0);
+	assert(!stats.hashes_failed);
+	assert(stats.bytes_allocated <= stats.bytes_allocated_peak);
+	assert(stats.bytes_allocated_peak >= (uint_least64_t)65536 << 10);
+	assert(!stats.pool_threads);
+	assert(!stats.queue_depth);
+	for (i = 0; i < LIBAR2SIMPLIFIED_STATS_CLASSES; i++)
+		for (j = 0; j < LIBAR2SIMPLIFIED_STATS_BUCKETS; j++)
+			sum += stats.latency[i][j];
+	assert(sum == stats.hashes_completed + stats.hashes_failed);
+}
+
+
+static void
+check_cancellation(const char *paramstr, int lineno)
+{
+	struct libar2simplified_options opts;
+	struct libar2_argon2_parameters *params;
+	struct libar2_context ctx;
+	volatile sig_atomic_t cancelled = 1;
+	char tag_buf[512], pwd_buf[] = "password";
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode(paramstr, NULL, NULL, NULL)));
+
+	memset(&opts, 0, sizeof(opts));
+	opts.cancel = &cancelled;
+	assert(libar2simplified_hash_opt(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, &opts) == -1);
+	assert(errno == ECANCELED);
+	assert(!libar2simplified_init_context_opt(&ctx, &opts));
+	assert(libar2_hash(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, &ctx) == -1);
+	assert(errno == ECANCELED);
+	libar2simplified_destroy_context(&ctx);
+
+	memset(&opts, 0, sizeof(opts));
+	assert(!clock_gettime(CLOCK_MONOTONIC, &opts.deadline));
+	assert(libar2simplified_hash_opt(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, &opts) == -1);
+	assert(errno == ETIMEDOUT);
+	assert(!libar2simplified_init_context_opt(&ctx, &opts));
+	assert(libar2_hash(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, &ctx) == -1);
+	assert(errno == ETIMEDOUT);
+	libar2simplified_destroy_context(&ctx);
+
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static uint_least64_t
+idle_threads(void)
+{
+	struct libar2simplified_stats stats;
+	libar2simplified_stats_snapshot(&stats);
+	return stats.idle_threads;
+}
+
+
+static void
+check_idle_workers(void)
+{
+	struct libar2simplified_options opts;
+	struct libar2_argon2_parameters *params;
+	char tag_buf[512], pwd_buf[16];
+	uint_least64_t before, after;
+	int i;
+
+	assert(!!(params = libar2simplified_decode("$argon2id$v=19$m=256,t=2,p=4$c29tZXNhbHQ$*32", NULL, NULL, NULL)));
+	memset(&opts, 0, sizeof(opts));
+	opts.max_threads = 4;
+	opts.oversubscribe = 1;
+	opts.stack_size = 256 << 10;
+	opts.idle_timeout = 60000;
+
+	before = idle_threads();
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts));
+	after = idle_threads();
+	assert(after > before);
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts));
+	assert(idle_threads() == after);
+
+	/* Lanes this small are not worth splitting over threads */
+	opts.oversubscribe = 0;
+	opts.idle_timeout = 1;
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts));
+	assert(idle_threads() == after);
+
+	opts.oversubscribe = 1;
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts));
+	for (i = 0; i < 5000 && idle_threads() > before; i++)
+		nanosleep(&(struct timespec){.tv_nsec = 1000000L}, NULL);
+	assert(idle_threads() == before);
+
+	free(params);
+}
+
+
+struct serial_hash {
+	struct libar2_argon2_parameters *params;
+	atomic_int *finished;
+	int ret;
+};
+
+
+static void *
+serial_hash_thread(void *data)
+{
+	struct serial_hash *h = data;
+	char tag_buf[512], pwd_buf[] = "password";
+	h->ret = libar2simplified_hash_opt(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, h->params, NULL);
+	atomic_fetch_add(h->finished, 1);
+	return NULL;
+}
+
+
+static size_t
+fan_out(void)
+{
+	struct libar2_context ctx;
+	size_t created;
+
+	assert(!libar2simplified_init_context_opt(&ctx, NULL));
+	assert(!ctx.init_thread_pool(SIZE_MAX, &created, &ctx));
+	if (created)
+		assert(!ctx.destroy_thread_pool(&ctx));
+	libar2simplified_destroy_context(&ctx);
+	return created;
+}
+
+
+static void
+check_serial_load(void)
+{
+	struct libar2_argon2_parameters *params;
+	struct serial_hash *hashes;
+	pthread_t *threads;
+	atomic_int finished = 0;
+	long int nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i, n = nproc < 1 ? 1 : (size_t)nproc;
+	int saturated = 0;
+
+	/* Lanes this small are hashed serially by the caller, which
+	 * keeps as many processors busy as a hash split over threads */
+	assert(!!(params = libar2simplified_decode("$argon2id$v=19$m=64,t=4096,p=1$c29tZXNhbHQ$*32", NULL, NULL, NULL)));
+	assert(!!(hashes = calloc(n, sizeof(*hashes))));
+	assert(!!(threads = calloc(n, sizeof(*threads))));
+	for (i = 0; i < n; i++) {
+		hashes[i].params = params;
+		hashes[i].finished = &finished;
+		assert(!pthread_create(&threads[i], NULL, serial_hash_thread, &hashes[i]));
+	}
+	while (atomic_load(&finished) < (int)n && !saturated)
+		saturated = !fan_out();
+	assert(saturated);
+	for (i = 0; i < n; i++) {
+		assert(!pthread_join(threads[i], NULL));
+		assert(!hashes[i].ret);
+	}
+	assert(fan_out() == (n < 2 ? 0 : n));
+
+	free(threads);
+	free(hashes);
+	free(params);
+}
+
+
+struct test_task {
+	struct test_task *next;
+	void (*function)(void *data);
+	void *data;
+	struct test_group *group;
+};
+
+/* Completions are counted per group, as
+ * multiple hashes may use the executor */
+struct test_group {
+	struct test_group *next;
+	void *group;
+	size_t completed;
+};
+
+struct test_executor {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct test_task *queue;
+	struct test_group *groups;
+	size_t submitted;
+	size_t fail_submit; /* the number of the submission to fail, 0 for none */
+	int stop;
+	pthread_t threads[3];
+	size_t nthreads;
+};
+
+
+static _Thread_local int on_test_executor = 0;
+
+
+/* Must be called with the mutex held */
+static void
+test_executor_run(struct test_executor *ex, struct test_task **taskp)
+{
+	struct test_task *task = *taskp;
+	*taskp = task->next;
+	pthread_mutex_unlock(&ex->mutex);
+	task->function(task->data);
+	pthread_mutex_lock(&ex->mutex);
+	task->group->completed += 1;
+	free(task);
+	pthread_cond_broadcast(&ex->cond);
+}
+
+
+static void *
+test_executor_loop(void *user_data)
+{
+	struct test_executor *ex = user_data;
+
+	on_test_executor = 1;
+	pthread_mutex_lock(&ex->mutex);
+	for (;;) {
+		while (!ex->queue && !ex->stop)
+			pthread_cond_wait(&ex->cond, &ex->mutex);
+		if (!ex->queue)
+			break;
+		test_executor_run(ex, &ex->queue);
+	}
+	pthread_mutex_unlock(&ex->mutex);
+	return NULL;
+}
+
+
+static size_t
+test_executor_parallelism(void *user_data)
+{
+	(void) user_data;
+	return 3;
+}
+
+
+/* Must be called with the mutex held */
+static struct test_group *
+test_executor_group(struct test_executor *ex, void *group)
+{
+	struct test_group *g;
+	for (g = ex->groups; g; g = g->next)
+		if (g->group == group)
+			return g;
+	g = calloc(1, sizeof(*g));
+	assert(!!g);
+	g->group = group;
+	g->next = ex->groups;
+	ex->groups = g;
+	return g;
+}
+
+
+static int
+test_executor_submit(void *group, void (*function)(void *data), void *data, void *user_data)
+{
+	struct test_executor *ex = user_data;
+	struct test_task *task;
+	pthread_mutex_lock(&ex->mutex);
+	if (ex->fail_submit && ex->submitted + 1 == ex->fail_submit) {
+		pthread_mutex_unlock(&ex->mutex);
+		errno = EAGAIN;
+		return -1;
+	}
+	pthread_mutex_unlock(&ex->mutex);
+	task = malloc(sizeof(*task));
+	if (!task)
+		return -1;
+	task->function = function;
+	task->data = data;
+	pthread_mutex_lock(&ex->mutex);
+	task->group = test_executor_group(ex, group);
+	task->next = ex->queue;
+	ex->queue = task;
+	ex->submitted += 1;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->mutex);
+	return 0;
+}
+
+
+static int
+test_executor_wait(void *group, size_t n, void *user_data)
+{
+	struct test_executor *ex = user_data;
+	struct test_task **taskp;
+	struct test_group *g;
+	pthread_mutex_lock(&ex->mutex);
+	assert(n > 0);
+	g = test_executor_group(ex, group);
+	while (g->completed < n) {
+		/* Like work-stealing pools, the executor's own threads
+		 * run the group's tasks while waiting, other threads
+		 * just block */
+		for (taskp = &ex->queue; on_test_executor && *taskp; taskp = &(*taskp)->next)
+			if ((*taskp)->group == g)
+				break;
+		if (on_test_executor && *taskp)
+			test_executor_run(ex, taskp);
+		else
+			pthread_cond_wait(&ex->cond, &ex->mutex);
+	}
+	g->completed -= n;
+	pthread_mutex_unlock(&ex->mutex);
+	return 0;
+}
+
+
+static void
+test_executor_start(struct test_executor *ex, struct libar2simplified_executor *executor, size_t nthreads)
+{
+	size_t i;
+
+	memset(ex, 0, sizeof(*ex));
+	assert(!pthread_mutex_init(&ex->mutex, NULL));
+	assert(!pthread_cond_init(&ex->cond, NULL));
+	assert(nthreads <= sizeof(ex->threads) / sizeof(*ex->threads));
+	for (i = 0; i < nthreads; i++)
+		assert(!pthread_create(&ex->threads[i], NULL, test_executor_loop, ex));
+	ex->nthreads = nthreads;
+
+	executor->parallelism = test_executor_parallelism;
+	executor->submit = test_executor_submit;
+	executor->wait = test_executor_wait;
+	executor->user_data = ex;
+}
+
+
+static void
+test_executor_stop(struct test_executor *ex)
+{
+	struct test_group *g;
+	size_t i;
+
+	pthread_mutex_lock(&ex->mutex);
+	ex->stop = 1;
+	pthread_cond_broadcast(&ex->cond);
+	pthread_mutex_unlock(&ex->mutex);
+	for (i = 0; i < ex->nthreads; i++)
+		assert(!pthread_join(ex->threads[i], NULL));
+
+	assert(!ex->queue);
+	while ((g = ex->groups)) {
+		ex->groups = g->next;
+		free(g);
+	}
+	pthread_cond_destroy(&ex->cond);
+	pthread_mutex_destroy(&ex->mutex);
+}
+
+
+static void
+check_executor(const char *hash, int lineno)
+{
+	struct test_executor ex;
+	struct libar2simplified_executor executor;
+	struct libar2simplified_options opts = {.executor = &executor, .oversubscribe = 1, .async_erase = 1};
+
+	from_lineno = lineno;
+
+	test_executor_start(&ex, &executor, 2);
+	check_hash_opt("password", hash, &opts, lineno);
+	assert(ex.submitted > 0);
+	test_executor_stop(&ex);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_executor_submit_failure(const char *hash, int lineno)
+{
+	struct test_executor ex;
+	struct libar2simplified_executor executor;
+	struct libar2simplified_options opts = {.executor = &executor, .oversubscribe = 1};
+	struct libar2simplified_batch_entry entries[4];
+	struct libar2_argon2_parameters *params;
+	char tag_bufs[4][512], pwd_bufs[4][sizeof("password")];
+	size_t i;
+
+	from_lineno = lineno;
+
+	/* The segments submitted before the failure are still running
+	 * on the executor's threads when the hash fails, and must not
+	 * write to the memory after it has been deallocated */
+	test_executor_start(&ex, &executor, 2);
+	ex.fail_submit = 10;
+	assert(!!(params = libar2simplified_decode(hash, NULL, NULL, NULL)));
+	strcpy(pwd_bufs[0], "password");
+	errno = 0;
+	assert(libar2simplified_hash_opt(tag_bufs[0], pwd_bufs[0], strlen(pwd_bufs[0]), params, &opts) == -1);
+	assert(errno == EAGAIN);
+	assert_zueq(ex.submitted, 9);
+	free(params);
+	test_executor_stop(&ex);
+
+	test_executor_start(&ex, &executor, 2);
+	ex.fail_submit = 3;
+	for (i = 0; i < sizeof(entries) / sizeof(*entries); i++) {
+		strcpy(pwd_bufs[i], "password");
+		entries[i].hash = tag_bufs[i];
+		entries[i].msg = pwd_bufs[i];
+		entries[i].msglen = strlen(pwd_bufs[i]);
+		assert(!!(entries[i].params = libar2simplified_decode(hash, NULL, NULL, NULL)));
+	}
+	errno = 0;
+	assert(libar2simplified_hash_batch(entries, sizeof(entries) / sizeof(*entries), &opts) == -1);
+	assert(errno == EAGAIN);
+	for (i = 0; i < sizeof(entries) / sizeof(*entries); i++) {
+		assert(!entries[i].error || entries[i].error == EAGAIN);
+		assert(!*pwd_bufs[i]);
+		free(entries[i].params);
+	}
+	test_executor_stop(&ex);
+	errno = 0;
+
+	from_lineno = 0;
+}
+
+
+struct executor_hash {
+	const struct libar2simplified_options *opts;
+	struct libar2_argon2_parameters *params;
+	char tag_buf[512];
+	char pwd_buf[sizeof("password")];
+	int ret;
+};
+
+
+static void
+executor_hash_task(void *data)
+{
+	struct executor_hash *h = data;
+	h->ret = libar2simplified_hash_opt(h->tag_buf, h->pwd_buf, sizeof(h->pwd_buf) - 1, h->params, h->opts);
+}
+
+
+static void
+check_executor_priorities(const char *hash, int lineno)
+{
+	struct test_executor ex;
+	struct libar2simplified_executor executor;
+	struct libar2simplified_options background = {.executor = &executor, .oversubscribe = 1,
+	                                              .priority = LIBAR2SIMPLIFIED_BACKGROUND};
+	struct libar2simplified_options interactive = {.executor = &executor, .oversubscribe = 1};
+	struct executor_hash hashes[2];
+	char *output_got;
+	size_t i;
+
+	from_lineno = lineno;
+
+	/* Background hashes are started on all of the executor's
+	 * threads, as the executor interface allows; they must not
+	 * wait there for the interactive hash, whose tasks can only
+	 * be run by those threads */
+	test_executor_start(&ex, &executor, 2);
+	for (i = 0; i < sizeof(hashes) / sizeof(*hashes); i++) {
+		hashes[i].opts = &background;
+		assert(!!(hashes[i].params = libar2simplified_decode(hash, NULL, NULL, NULL)));
+		strcpy(hashes[i].pwd_buf, "password");
+		assert(!test_executor_submit(hashes, executor_hash_task, &hashes[i], &ex));
+	}
+	check_hash_opt("password", hash, &interactive, lineno);
+	assert(!test_executor_wait(hashes, sizeof(hashes) / sizeof(*hashes), &ex));
+
+	for (i = 0; i < sizeof(hashes) / sizeof(*hashes); i++) {
+		assert(!hashes[i].ret);
+		output_got = libar2simplified_encode(hashes[i].params, hashes[i].tag_buf);
+		assert_streq(output_got, hash);
+		free(output_got);
+		free(hashes[i].params);
+	}
+	test_executor_stop(&ex);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_hash_step(const char *hash, int lineno)
+{
+	struct libar2simplified_hash_state *state;
+	struct libar2_argon2_parameters *params;
+	char tag_buf[512], pwd_buf[] = "password", *output_got;
+	size_t steps = 0;
+	int r;
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode(hash, NULL, NULL, NULL)));
+
+	state = libar2simplified_hash_start(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, NULL);
+	if (!state && errno == ENOSYS) {
+		/* Not supported on this system */
+		assert(!pwd_buf[0]);
+		free(params);
+		from_lineno = 0;
+		return;
+	}
+	assert(!!state);
+	assert(libar2simplified_hash_step(state, 0) == -1 && errno == EINVAL);
+	errno = 0;
+	while (!(r = libar2simplified_hash_step(state, 1)))
+		steps += 1;
+	assert(r == 1);
+	/* One step per segment, the last one also finishes */
+	assert_zueq(steps, (size_t)params->t_cost * params->lanes * 4U - 1U);
+	assert(!pwd_buf[0]);
+	output_got = libar2simplified_encode(params, tag_buf);
+	assert_streq(output_got, hash);
+	free(output_got);
+
+	strcpy(pwd_buf, "password");
+	assert(!!(state = libar2simplified_hash_start(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, NULL)));
+	assert(!libar2simplified_hash_step(state, 3));
+	libar2simplified_hash_abort(state);
+	assert(!pwd_buf[0]);
+
+	strcpy(pwd_buf, "password");
+	assert(!!(state = libar2simplified_hash_start(tag_buf, pwd_buf, sizeof(pwd_buf) - 1, params, NULL)));
+	errno = 0;
+	libar2simplified_hash_abort(state);
+	assert(!pwd_buf[0]);
+	assert(!errno);
+
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_derive_keys(const char *paramstr, const char *enc_expect, const char *mac_expect, const char *idx_expect, int lineno)
+{
+	struct libar2_argon2_parameters *params;
+	unsigned char enc[32], mac[32], idx[16], enc2[32], mac2[32], idx2[16];
+	char pwd_buf[] = "password", b64[64];
+	struct libar2simplified_subkey subkeys[] = {
+		{"encryption", enc, sizeof(enc)},
+		{"mac", mac, sizeof(mac)},
+		{"index", idx, sizeof(idx)}
+	};
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode(paramstr, NULL, NULL, NULL)));
+
+	assert(!libar2simplified_derive_keys(subkeys, 3, pwd_buf, sizeof(pwd_buf) - 1, params, NULL));
+	assert(!pwd_buf[0]);
+	assert(memcmp(enc, mac, sizeof(enc)));
+	assert(memcmp(enc, idx, sizeof(idx)));
+
+	/* Known answers, pinning the personalisation and key layout */
+	libar2_encode_base64(b64, enc, sizeof(enc));
+	assert_streq(b64, enc_expect);
+	libar2_encode_base64(b64, mac, sizeof(mac));
+	assert_streq(b64, mac_expect);
+	libar2_encode_base64(b64, idx, sizeof(idx));
+	assert_streq(b64, idx_expect);
+
+	/* The keys only depend on the password, parameters, and labels */
+	strcpy(pwd_buf, "password");
+	subkeys[0].key = enc2;
+	subkeys[1].key = mac2;
+	subkeys[2].key = idx2;
+	assert(!libar2simplified_derive_keys(&subkeys[1], 2, pwd_buf, sizeof(pwd_buf) - 1, params, NULL));
+	strcpy(pwd_buf, "password");
+	assert(!libar2simplified_derive_keys(subkeys, 1, pwd_buf, sizeof(pwd_buf) - 1, params, NULL));
+	assert(!memcmp(enc, enc2, sizeof(enc)));
+	assert(!memcmp(mac, mac2, sizeof(mac)));
+	assert(!memcmp(idx, idx2, sizeof(idx)));
+
+	strcpy(pwd_buf, "password");
+	subkeys[2].label = "mac";
+	assert(libar2simplified_derive_keys(subkeys, 3, pwd_buf, sizeof(pwd_buf) - 1, params, NULL) == -1);
+	assert(errno == EINVAL);
+	assert(!pwd_buf[0]);
+	subkeys[2].label = "index";
+	subkeys[2].keylen = 65;
+	assert(libar2simplified_derive_keys(subkeys, 3, pwd_buf, sizeof(pwd_buf) - 1, params, NULL) == -1);
+	assert(errno == EINVAL);
+	subkeys[2].keylen = sizeof(idx);
+	params->hashlen = 65;
+	assert(libar2simplified_derive_keys(subkeys, 3, pwd_buf, sizeof(pwd_buf) - 1, params, NULL) == -1);
+	assert(errno == EINVAL);
+	params->hashlen = 31;
+	assert(libar2simplified_derive_keys(subkeys, 3, pwd_buf, sizeof(pwd_buf) - 1, params, NULL) == -1);
+	assert(errno == EINVAL);
+	errno = 0;
+
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static void
+check_estimate(void)
+{
+	struct libar2simplified_cost cost;
+	struct libar2_argon2_parameters *params;
+
+	/* Make the prediction deterministic */
+	assert(!setenv("LIBAR2SIMPLIFIED_COST_MODEL", "1000000,1000,500", 1));
+
+	assert(!!(params = libar2simplified_decode("$argon2id$v=19$m=1024,t=2,p=4$*16$*32", NULL, NULL, NULL)));
+	assert(!libar2simplified_estimate(&cost, params, 4));
+	assert(cost.threads == 4);
+	assert(cost.cpu_time == 1000 + 512 + 2048);
+	assert(cost.wall_time == 1000 + 512 + 512);
+	assert(cost.peak_memory == (uint_least64_t)1024 * 1024 + libar2_hash_buf_size(params));
+	assert(!libar2simplified_estimate(&cost, params, 2));
+	assert(cost.threads == 2);
+	assert(cost.wall_time == 1000 + 512 + 1024);
+	assert(!libar2simplified_estimate(&cost, params, 16));
+	assert(cost.threads == 4);
+	params->m_cost = 256;
+	assert(!libar2simplified_estimate(&cost, params, 4));
+	assert(cost.threads == 1);
+	assert(cost.wall_time == cost.cpu_time);
+	params->m_cost = 8;
+	errno = 0;
+	assert(libar2simplified_estimate(&cost, params, 4) == -1 && errno == EINVAL);
+	errno = 0;
+	free(params);
+
+	unsetenv("LIBAR2SIMPLIFIED_COST_MODEL");
+}
+
+
+static void
+check_degraded(const char *hash, int lineno)
+{
+	struct libar2simplified_options opts;
+	struct libar2simplified_stats before, after;
+
+	/* A stack this large cannot be mapped, so thread
+	 * creation fails, but the hash must still succeed */
+	memset(&opts, 0, sizeof(opts));
+	opts.max_threads = 4;
+	opts.oversubscribe = 1;
+	opts.stack_size = (size_t)1 << (sizeof(size_t) > 4 ? 50 : 31);
+
+	libar2simplified_stats_snapshot(&before);
+	assert(!before.idle_threads);
+	check_hash_opt("password", hash, &opts, lineno);
+	libar2simplified_stats_snapshot(&after);
+	assert(after.hashes_degraded == before.hashes_degraded + 1);
+	assert(after.hashes_failed == before.hashes_failed);
+	assert(!after.pool_threads);
+}
+
+
+static char pressure_dir[] = "/tmp/ar2s-test-pressure-XXXXXX";
+
+
+static void
+write_pressure(const char *file, const char *avg10)
+{
+	char path[sizeof(pressure_dir) + 32];
+	FILE *f;
+
+	sprintf(path, "%s/%s", pressure_dir, file);
+	assert(!!(f = fopen(path, "w")));
+	fprintf(f, "some avg10=%s avg60=0.00 avg300=0.00 total=0\n", avg10);
+	fprintf(f, "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+	assert(!fclose(f));
+}
+
+
+static void
+setup_pressure(void)
+{
+	assert(!!mkdtemp(pressure_dir));
+	write_pressure("memory.pressure", "0.00");
+	write_pressure("cpu.pressure", "0.00");
+	assert(!setenv("LIBAR2SIMPLIFIED_PRESSURE", pressure_dir, 1));
+}
+
+
+static void
+check_pressure_governor(void)
+{
+	struct libar2simplified_options opts;
+	struct libar2simplified_hash_state *state;
+	struct libar2_argon2_parameters *params, *step_params;
+	struct libar2_context ctx;
+	char tag_buf[512], pwd_buf[16], step_tag_buf[512], step_pwd_buf[16], path[sizeof(pressure_dir) + 32];
+	void *matrix;
+	int r = 0;
+
+	write_pressure("memory.pressure", "50.00");
+	write_pressure("cpu.pressure", "50.00");
+	/* Wait for the next sample */
+	nanosleep(&(struct timespec){.tv_sec = 1, .tv_nsec = 100000000L}, NULL);
+
+	/* Only one matrix may be held under this much pressure */
+	libar2simplified_init_context(&ctx);
+	assert(!!(matrix = ctx.allocate(2048, 1024, 64, &ctx)));
+
+	memset(&opts, 0, sizeof(opts));
+	assert(!clock_gettime(CLOCK_MONOTONIC, &opts.deadline));
+	opts.deadline.tv_nsec = opts.deadline.tv_nsec >= 900000000L ? 999999999L : opts.deadline.tv_nsec + 100000000L;
+	assert(!!(params = libar2simplified_decode("$argon2id$v=19$m=2048,t=1,p=1$c29tZXNhbHQ$*32", NULL, NULL, NULL)));
+	stpcpy(pwd_buf, "password");
+	errno = 0;
+	assert(libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, &opts) == -1);
+	assert(errno == ETIMEDOUT);
+
+	/* Stepwise calculations return to the caller instead of waiting */
+	assert(!!(step_params = libar2simplified_decode("$argon2id$v=19$m=2048,t=1,p=1$c29tZXNhbHQ$*32", NULL, NULL, NULL)));
+	stpcpy(step_pwd_buf, "password");
+	state = libar2simplified_hash_start(step_tag_buf, step_pwd_buf, strlen(step_pwd_buf), step_params, NULL);
+	assert(state || errno == ENOSYS);
+	if (state) {
+		assert(!libar2simplified_hash_step(state, 1));
+		assert(!libar2simplified_hash_step(state, 1));
+		libar2simplified_hash_abort(state);
+		stpcpy(step_pwd_buf, "password");
+		state = libar2simplified_hash_start(step_tag_buf, step_pwd_buf, strlen(step_pwd_buf), step_params, NULL);
+		assert(!!state);
+		assert(!libar2simplified_hash_step(state, 1));
+	}
+
+	/* Small matrices are not counted */
+	params->m_cost = 256;
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, NULL));
+
+	ctx.deallocate(matrix, &ctx);
+	params->m_cost = 2048;
+	if (state)
+		while (!(r = libar2simplified_hash_step(state, 1)));
+	assert(!state || r == 1);
+	free(step_params);
+	stpcpy(pwd_buf, "password");
+	assert(!libar2simplified_hash_opt(tag_buf, pwd_buf, strlen(pwd_buf), params, NULL));
+	free(params);
+
+	sprintf(path, "%s/%s", pressure_dir, "memory.pressure");
+	unlink(path);
+	sprintf(path, "%s/%s", pressure_dir, "cpu.pressure");
+	unlink(path);
+	rmdir(pressure_dir);
+}
+
+
+static void
+check_pressure_governor_isolated(void)
+{
+	/* The environment is only read once per process, so
+	 * the governor is tested in a child that is forked
+	 * before the first hash, leaving the rest of the suite
+	 * to run without LIBAR2SIMPLIFIED_PRESSURE */
+	pid_t pid;
+	int status;
+
+	assert((pid = fork()) != -1);
+	if (!pid) {
+		setup_pressure();
+		check_pressure_governor();
+		exit(0);
+	}
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+
+static void
+check_fixed_params(void)
+{
+	static const struct libar2_argon2_parameters fixed = LIBAR2SIMPLIFIED_PARAMS_INIT(id, 19, 3072, 32, 4, 16, 48);
+	struct libar2_argon2_parameters *params;
+
+	assert_streq(LIBAR2SIMPLIFIED_PARAMS_STRING(id, 19, 3072, 32, 4, 16, 48), RECOMMENDATION_SIDE_CHANNEL_ENVIRONMENT);
+	assert(!!(params = libar2simplified_decode(LIBAR2SIMPLIFIED_PARAMS_STRING(id, 19, 3072, 32, 4, 16, 48),
+	                                           NULL, NULL, NULL)));
+	assert(params->type == fixed.type);
+	assert(params->version == fixed.version);
+	assert(params->t_cost == fixed.t_cost);
+	assert(params->m_cost == fixed.m_cost);
+	assert(params->lanes == fixed.lanes);
+	assert(params->saltlen == fixed.saltlen);
+	assert(params->hashlen == fixed.hashlen);
+	assert(!fixed.salt);
+	free(params);
+}
+
+
+static void
+check_pack(const char *str, int with_salt, int lineno)
+{
+	struct libar2_argon2_parameters *params, *unpacked;
+	unsigned char buf[512];
+	char *tag, *end, *encoded;
+	const void *hash;
+	size_t size, n, hashlen;
+	unsigned char hashbuf[256];
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(params = libar2simplified_decode(str, &tag, &end, NULL)));
+	if (!with_salt)
+		params->salt = NULL; /* encode the length rather than the generated salt */
+	if (tag) {
+		hashlen = sizeof(hashbuf);
+		assert(libar2_decode_base64(tag, hashbuf, &hashlen) == (size_t)(end - tag));
+		assert_zueq(hashlen, params->hashlen);
+	}
+
+	size = libar2simplified_pack(NULL, params, tag ? hashbuf : NULL);
+	assert(size >= LIBAR2SIMPLIFIED_PACK_HEADER_SIZE && size <= sizeof(buf));
+	assert_zueq(libar2simplified_pack(buf, params, tag ? hashbuf : NULL), size);
+	assert(buf[0] == LIBAR2SIMPLIFIED_PACK_VERSION);
+	assert(size < strlen(str));
+
+	assert(!libar2simplified_unpack(buf, size - 1, NULL, NULL));
+	assert(errno == EINVAL);
+	assert(!!(unpacked = libar2simplified_unpack(buf, sizeof(buf), &hash, &n)));
+	assert_zueq(n, size);
+	assert(!tag == !hash);
+	assert(!params->salt == !unpacked->salt);
+	assert(!!(encoded = libar2simplified_encode(unpacked, *(void **)(void *)&hash)));
+	assert_streq(encoded, str);
+
+	free(encoded);
+	free(unpacked);
+	free(params);
+
+	from_lineno = 0;
+}
+
+
+static uint_least64_t
+hashes_completed(void)
+{
+	struct libar2simplified_stats stats;
+	libar2simplified_stats_snapshot(&stats);
+	return stats.hashes_completed;
+}
+
+
+static int
+verify(const char *pwd, const char *hashstr, struct libar2simplified_verify_cache *cache)
+{
+	char pwd_buf[64];
+	assert(strlen(pwd) < sizeof(pwd_buf));
+	stpcpy(pwd_buf, pwd);
+	errno = 0;
+	return libar2simplified_verify(pwd_buf, hashstr, cache);
+}
+
+
+static void
+check_verify(const char *paramstr, const char *hashstr, int lineno)
+{
+	struct libar2simplified_verify_cache *cache;
+	char pwd_buf[] = "password", *computed;
+	uint_least64_t n;
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(computed = libar2simplified_crypt(pwd_buf, paramstr, NULL)));
+	assert_streq(computed, hashstr);
+	assert(!*pwd_buf);
+
+	assert(verify("password", computed, NULL) == 1);
+	assert(verify("passwore", computed, NULL) == 0);
+	assert(verify("password", paramstr, NULL) == -1 && errno == EINVAL);
+
+	assert(!!(cache = libar2simplified_verify_cache_create(2, 60000)));
+	n = hashes_completed();
+	assert(verify("password", computed, cache) == 1);
+	assert(verify("passwore", computed, cache) == 0);
+	assert(hashes_completed() == n + 2);
+	assert(verify("password", computed, cache) == 1);
+	assert(verify("passwore", computed, cache) == 0);
+	assert(hashes_completed() == n + 2);
+	assert(verify("drowssap", computed, cache) == 0);
+	assert(verify("passwore", computed, cache) == 0);
+	assert(hashes_completed() == n + 3);
+	assert(verify("password", computed, cache) == 1);
+	assert(hashes_completed() == n + 4);
+	libar2simplified_verify_cache_destroy(cache);
+
+	assert(!!(cache = libar2simplified_verify_cache_create(2, 0)));
+	n = hashes_completed();
+	assert(verify("password", computed, cache) == 1);
+	assert(verify("password", computed, cache) == 1);
+	assert(hashes_completed() == n + 2);
+	libar2simplified_verify_cache_destroy(cache);
+
+	assert(!libar2simplified_verify_cache_create(0, 0) && errno == EINVAL);
+
+	free(computed);
+
+	from_lineno = 0;
+}
+
+
+struct concurrent_verify {
+	pthread_barrier_t *barrier;
+	const char *hashstr;
+	int verdict;
+};
+
+
+static void *
+concurrent_verify(void *data)
+{
+	struct concurrent_verify *cv = data;
+	pthread_barrier_wait(cv->barrier);
+	cv->verdict = verify("password", cv->hashstr, NULL);
+	return NULL;
+}
+
+
+static void
+check_verify_coalescing(const char *paramstr, int lineno)
+{
+#define N 4
+	struct concurrent_verify cvs[N];
+	pthread_barrier_t barrier;
+	pthread_t threads[N];
+	char pwd_buf[] = "password", *computed;
+	uint_least64_t n;
+	size_t i;
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(!!(computed = libar2simplified_crypt(pwd_buf, paramstr, NULL)));
+	assert(!pthread_barrier_init(&barrier, NULL, N));
+
+	n = hashes_completed();
+	for (i = 0; i < N; i++) {
+		cvs[i].barrier = &barrier;
+		cvs[i].hashstr = computed;
+		cvs[i].verdict = -1;
+		assert(!pthread_create(&threads[i], NULL, concurrent_verify, &cvs[i]));
+	}
+	for (i = 0; i < N; i++) {
+		assert(!pthread_join(threads[i], NULL));
+		assert(cvs[i].verdict == 1);
+	}
+	/* The requests start together, and each hash takes
+	 * long enough that the others join it */
+	assert(hashes_completed() < n + N);
+
+	/* Nothing is left in flight */
+	n = hashes_completed();
+	assert(verify("password", computed, NULL) == 1);
+	assert(hashes_completed() == n + 1);
+
+	pthread_barrier_destroy(&barrier);
+	free(computed);
+
+	from_lineno = 0;
+#undef N
+}
+
+
+static void
+read_fully(int fd, unsigned char *buf, size_t n)
+{
+	ssize_t r;
+	for (; n; buf = &buf[r], n -= (size_t)r)
+		assert((r = read(fd, buf, n)) > 0);
+}
+
+
+static void *
+fake_daemon(void *data)
+{
+	int fd = *(int *)data;
+	struct libar2_argon2_parameters *params;
+	unsigned char header[LIBAR2SIMPLIFIED_REMOTE_REQUEST_HEADER_SIZE], body[512], tag[256];
+	size_t size, packlen;
+
+	/* Answer the first request, and refuse the second */
+	read_fully(fd, header, sizeof(header));
+	size = (size_t)header[0] | (size_t)header[1] << 8;
+	assert(!header[2] && !header[3] && size <= sizeof(body));
+	read_fully(fd, body, size);
+	assert(!!(params = libar2simplified_unpack(body, size, NULL, &packlen)));
+	assert(!!params->salt);
+	assert_zueq(packlen + header[4] + header[8] + header[12], size);
+	params->key = header[8] ? &body[packlen + header[4]] : NULL;
+	params->keylen = header[8];
+	assert(!libar2simplified_hash(tag, &body[packlen], header[4], params));
+	memset(header, 0, sizeof(header));
+	header[0] = (unsigned char)params->hashlen;
+	assert(write(fd, header, LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE) == LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE);
+	assert(write(fd, tag, params->hashlen) == (ssize_t)params->hashlen);
+	free(params);
+
+	read_fully(fd, header, sizeof(header));
+	read_fully(fd, body, (size_t)header[0] | (size_t)header[1] << 8);
+	memset(header, 0, sizeof(header));
+	header[4] = ENOMEM;
+	assert(write(fd, header, LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE) == LIBAR2SIMPLIFIED_REMOTE_RESPONSE_HEADER_SIZE);
+
+	close(fd);
+	return NULL;
+}
+
+
+static void
+check_remote(const char *paramstr, int lineno)
+{
+	struct libar2_argon2_parameters *params;
+	unsigned char expected[256], hash[256], key[] = "pepper";
+	char pwd_buf[] = "password";
+	pthread_t thread;
+	int fds[2];
+
+	from_lineno = lineno;
+	errno = 0;
+
+	assert(libar2simplified_remote_connect("/nonexistent/ar2simplified.socket") == -1);
+	assert(errno == ENOENT);
+
+	assert(!!(params = libar2simplified_decode(paramstr, NULL, NULL, NULL)));
+	params->key = key;
+	params->keylen = sizeof(key) - 1;
+	assert(!libar2simplified_hash(expected, pwd_buf, sizeof(pwd_buf) - 1, params));
+	stpcpy(pwd_buf, "password");
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	assert(!pthread_create(&thread, NULL, fake_daemon, &fds[1]));
+	assert(!libar2simplified_remote_hash(fds[0], hash, pwd_buf, sizeof(pwd_buf) - 1, params));
+	assert(!memcmp(hash, expected, params->hashlen));
+	assert(!*pwd_buf);
+	stpcpy(pwd_buf, "password");
+	assert(libar2simplified_remote_hash(fds[0], hash, pwd_buf, sizeof(pwd_buf) - 1, params) == -1);
+	assert(errno == ENOMEM);
+	assert(!*pwd_buf);
+	assert(!pthread_join(thread, NULL));
+	close(fds[0]);
+
+	params->salt = NULL;
+	assert(libar2simplified_remote_hash(-1, hash, pwd_buf, sizeof(pwd_buf) - 1, params) == -1);
+	assert(errno == EINVAL);
+
+	free(params);
+
+	from_lineno = 0;
+}
+
+
 #if TIME_RECOMMENDATIONS
 static void
 time_hash(const char *params_str, const char *params_name, int lineno)
@@ -238,6 +1411,8 @@ int
 main(void)
 {
 #if 1
+	check_pressure_governor_isolated();
+
 #define CHECK(PWD, HASH)\
 	check_hash(MEM(PWD), HASH, HASH, NULL, __LINE__)
 
@@ -291,8 +1466,68 @@ main(void)
 
 	check_random_salt_generate();
 
+#undef CHECK
+#define CHECK(PWD, HASH, ...)\
+	check_hash_opt(PWD, HASH, &(struct libar2simplified_options){__VA_ARGS__}, __LINE__)
+
+	CHECK("password", "$argon2id$v=19$m=65536,t=1,p=1$c29tZXNhbHQ$9qWtwbpyPd3vm1rB1GThgPzZ3/ydHL92zKL+15XZypg",
+	      .async_erase = 1);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .async_erase = 1);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .max_threads = 1);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .max_threads = 3);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .max_threads = 64, .oversubscribe = 1);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .priority = LIBAR2SIMPLIFIED_BACKGROUND);
+	CHECK("password", "$argon2id$v=19$m=65536,t=1,p=1$c29tZXNhbHQ$9qWtwbpyPd3vm1rB1GThgPzZ3/ydHL92zKL+15XZypg",
+	      .priority = LIBAR2SIMPLIFIED_BACKGROUND);
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .matrix_directory = ".");
+	CHECK("password", "$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g",
+	      .matrix_directory = ".", .async_erase = 1, .max_threads = 1);
+	CHECK("password", "$argon2i$v=19$m=256,t=2,p=1$c29tZXNhbHQ$iekCn0Y3spW+sCcFanM2xBT63UP2sghkUoHLIUpWRS8",
+	      .matrix_directory = "/nonexistent/directory");
+
+#undef CHECK
+
 	assert_streq(libar2simplified_recommendation(0), RECOMMENDATION_SIDE_CHANNEL_ENVIRONMENT);
 	assert_streq(libar2simplified_recommendation(1), RECOMMENDATION_SIDE_CHANNEL_FREE_ENVIRONMENT);
+
+	check_hash_batch(NULL, __LINE__);
+	check_hash_batch(&(struct libar2simplified_options){.max_threads = 1}, __LINE__);
+	check_hash_batch(&(struct libar2simplified_options){.max_threads = 3, .oversubscribe = 1}, __LINE__);
+	check_hash_batch(&(struct libar2simplified_options){.priority = LIBAR2SIMPLIFIED_BACKGROUND}, __LINE__);
+
+	check_derive_keys("$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32",
+	                  "wzVC7dvfUIefK5hhOPjx4MVGv7qNGkeXzvmBRGIgtJY",
+	                  "Tyh01TTi5qm1zsLAZ3CBCPUu9IXNYnzoMAds7Poyzdg",
+	                  "KNnd9oPI3v2kCt9gcVRIxQ", __LINE__);
+	check_fixed_params();
+	check_estimate();
+	check_degraded("$argon2i$v=19$m=256,t=2,p=2$c29tZXNhbHQ$T/XOJ2mh1/TIpJHfCdQan76Q5esCFVoT5MAeIM1Oq2E", __LINE__);
+	check_idle_workers();
+	check_serial_load();
+	check_executor("$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g", __LINE__);
+	check_executor_priorities("$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$FRWpYzcrsos+DHNInvfsl0g8mZBdPqUdarIYh/Pnc1g", __LINE__);
+	check_pack("$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$nf65EOgLrQMR/uIPnA4rEsF5h7TKyQwu9U1bMCHGi/4", 1, __LINE__);
+	check_pack("$argon2i$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32", 1, __LINE__);
+	check_pack("$argon2d$v=16$m=3072,t=32,p=4$*16$*48", 0, __LINE__);
+	check_stats();
+
+	check_cancellation("$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$*32", __LINE__);
+	check_cancellation("$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32", __LINE__);
+	check_matrix_directory_failure();
+	check_executor_submit_failure("$argon2id$v=19$m=2048,t=16,p=16$c29tZXNhbHQ$*32", __LINE__);
+	check_hash_step("$argon2i$v=19$m=256,t=2,p=2$c29tZXNhbHQ$T/XOJ2mh1/TIpJHfCdQan76Q5esCFVoT5MAeIM1Oq2E", __LINE__);
+
+	check_verify("$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32",
+	             "$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$nf65EOgLrQMR/uIPnA4rEsF5h7TKyQwu9U1bMCHGi/4", __LINE__);
+	check_verify_coalescing("$argon2id$v=19$m=65536,t=1,p=1$c29tZXNhbHQ$*32", __LINE__);
+
+	check_remote("$argon2id$v=19$m=256,t=2,p=1$c29tZXNhbHQ$*32", __LINE__);
 #endif
 
 #if TIME_RECOMMENDATIONS